@@ -1,6 +1,10 @@
 #pragma once
 
 #include <sys/process.h>
+#include <sys/scheduler.h>
+#include <arch/gdt.h>
+#include <mem/slab.h>
+#include <mem/pmm.h>
 
 #define LAPIC_ID                0x0020  // Local APIC ID
 #define LAPIC_VER               0x0030  // Local APIC Version
@@ -73,12 +77,28 @@
 #define APIC_DELMOD_START                   0x6
 #define APIC_DELMOD_ExtINT                  0x7
 
+#define CORE_CACHE_LINE     64
+
+/// @brief Context of a core, the first fields are accessed from assembly through the GS base.
 typedef struct CORE_CONTEXT
 {
+    struct CORE_CONTEXT *self;  /* Read through the GS base of the core, must stay first. */
+    uint64_t syscallStack;      /* Kernel stack of the current process, loaded by the syscall entry. */
+    uint64_t userStack;         /* Stack of the process while the syscall entry switches stacks. */
     uint8_t id;
-    uint64_t stack;
+    uint64_t stack;             /* Top of the stack the core switches processes on. */
     Process_t *currentProcess;
-} __PACKED__ CoreContext_t;
+    Process_t *idle;            /* Runs when no other process is ready, never queued. */
+    RunQueue_t runQueue __ALIGNED__(CORE_CACHE_LINE);   /* Locked by other cores, kept off the lines of the private fields. */
+    void *deadStack;            /* Kernel stack of a process that exited on the core, freed on the next exit. */
+    GDTBlock_t *gdt;
+    KmemMagazine_t magazines[KMEM_MAX_CACHES];
+    FrameCache_t frameCache;
+} __ALIGNED__(CORE_CACHE_LINE) CoreContext_t;
+
+_Static_assert(offsetof(CoreContext_t, self) == 0x0, "Offset used by currentCPU");
+_Static_assert(offsetof(CoreContext_t, syscallStack) == 0x8, "Offset used by the syscall entry");
+_Static_assert(offsetof(CoreContext_t, userStack) == 0x10, "Offset used by the syscall entry");
 
 /// @brief Initialize the APIC.
 void apic_init();
@@ -107,6 +127,10 @@ void apic_write_register(const uint32_t offset, const uint32_t value);
 /// @brief Send an eoi to the apic.
 void apic_eoi();
 
+/// @brief Point the GS base of the current core at its context, used by currentCPU.
+/// @param core Context of the current core.
+void apic_set_core(CoreContext_t *core);
+
 /// @brief Get the current core.
 /// @return Current core.
 CoreContext_t *currentCPU();
@@ -114,4 +138,5 @@ CoreContext_t *currentCPU();
 extern bool _ApicInitialized;       /* Is APIC initialized. */
 extern uint32_t _BspID;             /* APIC ID of the BSP. */
 extern uint32_t _CoreCount;    /* Amount of available cores. */
-extern CoreContext_t *_Cores;       /* Available cores. */
\ No newline at end of file
+extern CoreContext_t *_Cores;       /* Available cores. */
+extern bool _CoresReady;            /* Are the core contexts usable by currentCPU. */
\ No newline at end of file
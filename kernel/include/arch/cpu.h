@@ -36,6 +36,10 @@ void __rdmsr(uint32_t msr, uint32_t *lo, uint32_t *hi);
 /// @param hi high part.
 void __wrmsr(uint32_t msr, uint32_t lo, uint32_t hi);
 
+/// @brief Zero a page using non-temporal stores.
+/// @param page Page aligned address of the page.
+void x64_zero_page(void *page);
+
 /// @brief Read the time-stamp counter.
 /// @return Time-Stamp counter.
 inline uint64_t __rdtsc()
@@ -2,6 +2,8 @@
 
 #include <common.h>
 
+struct CORE_CONTEXT;
+
 /// @brief TSS entry.
 typedef struct TSS_ENTRY
 {
@@ -54,8 +56,8 @@ typedef struct GDT
 
 #define GDT_KERNEL_CS           0x8
 #define GDT_KERNEL_DS           0x10
-#define GDT_USER_CS             ((4 * 8) | 0b11)
-#define GDT_USER_DS             ((5 * 8) | 0b11)
+#define GDT_USER_CS             ((5 * 8) | 0b11)
+#define GDT_USER_DS             ((4 * 8) | 0b11)    /* Precedes the code segment, as SYSRET expects. */
 #define GDT_TSS_INDEX           ((6 * 8) | 0b11)
 
 #define GDT_PRESENT             (1 << 7)
@@ -75,5 +77,14 @@ typedef struct GDT
 
 #define KERNEL_STACK_SIZE       (8 * PAGE_SIZE)
 
-/// @brief Load the GDT into the CPU.
-void gdt_load();
\ No newline at end of file
+/// @brief Load the GDT into the CPU, other cores load the one prepared for them by gdt_initCore.
+void gdt_load();
+
+/// @brief Prepare the GDT and TSS of a core, the BSP keeps the ones it loaded.
+/// @param core Core to prepare.
+void gdt_initCore(struct CORE_CONTEXT *core);
+
+/// @brief Set the stack used when entering the kernel from user space on the current core.
+/// @param stack Bottom of the stack.
+/// @param stackSize Size of the stack.
+void tss_setKernelStack(void *stack, const uint64_t stackSize);
\ No newline at end of file
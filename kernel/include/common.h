@@ -22,6 +22,8 @@ extern uint64_t _KernelStart, _KernelEnd, _KernelWritableStart, _KernelWritableE
 
 #define TIMER_ISR               IRQ0
 #define PS2_KBD_ISR             (IRQ0 + 1)
+#define ATA_PRIMARY_ISR         (IRQ0 + 14)
+#define ATA_SECONDARY_ISR       (IRQ0 + 15)
 #define SYSCALL_ISR             0x80
 #define IPI_ISR                 0xFE
 #define SPURIOUS_ISR            0xFF
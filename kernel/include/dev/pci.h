@@ -0,0 +1,57 @@
+#pragma once
+
+#include <common.h>
+
+#define PCI_CONFIG_ADDRESS      0xCF8
+#define PCI_CONFIG_DATA         0xCFC
+
+#define PCI_MAX_BUS             256
+#define PCI_MAX_DEVICE          32
+#define PCI_MAX_FUNCTION        8
+
+#define PCI_VENDOR_ID           0x00
+#define PCI_COMMAND             0x04
+#define PCI_CLASS               0x08
+#define PCI_HEADER_TYPE         0x0C
+#define PCI_BAR0                0x10
+#define PCI_BAR4                0x20
+#define PCI_INTERRUPT_LINE      0x3C
+
+#define PCI_COMMAND_IO          0x1
+#define PCI_COMMAND_MEMORY      0x2
+#define PCI_COMMAND_BUS_MASTER  0x4
+
+#define PCI_BAR_IO              0x1
+#define PCI_BAR_IO_MASK         0xFFFFFFFC
+
+#define PCI_CLASS_STORAGE       0x01
+#define PCI_SUBCLASS_IDE        0x01
+
+#define PCI_NO_VENDOR           0xFFFF
+
+/// @brief Location of a function on the PCI bus.
+typedef struct PCI_DEVICE
+{
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+} PciDevice_t;
+
+/// @brief Read a dword from the configuration space of a function.
+/// @param dev Function to read from.
+/// @param offset Dword aligned offset in the configuration space.
+/// @return Value that was read.
+uint32_t pci_read(const PciDevice_t *dev, const uint8_t offset);
+
+/// @brief Write a dword to the configuration space of a function.
+/// @param dev Function to write to.
+/// @param offset Dword aligned offset in the configuration space.
+/// @param value Value to write.
+void pci_write(const PciDevice_t *dev, const uint8_t offset, const uint32_t value);
+
+/// @brief Find the first function of a class.
+/// @param class Base class of the function.
+/// @param subclass Subclass of the function.
+/// @param dev Found function.
+/// @return true if a function was found, false, otherwise.
+bool pci_findClass(const uint8_t class, const uint8_t subclass, PciDevice_t *dev);
\ No newline at end of file
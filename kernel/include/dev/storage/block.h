@@ -0,0 +1,70 @@
+#pragma once
+
+#include <common.h>
+
+struct BLOCK_REQUEST;
+struct PROCESS;
+
+typedef void (*request_callback_t)(struct BLOCK_REQUEST *);
+
+/// @brief Transfer of sectors from or to the block device.
+typedef struct BLOCK_REQUEST
+{
+    uint64_t sector;
+    uint32_t count;
+    bool write;
+    bool flush;                     /* Flush the device cache, requests aren't reordered across it. */
+    uint8_t *buffer;
+    volatile bool done;
+    bool success;
+    request_callback_t callback;    /* Called from the interrupt handler on completion, may be NULL. */
+    void *context;                  /* Data of the submitter. */
+    struct PROCESS *waiter;
+    struct BLOCK_REQUEST *next;
+    struct BLOCK_REQUEST *merged;       /* Following contiguous request transferred by the same command. */
+    struct BLOCK_REQUEST *coalesced;    /* Superseded writes of the same sectors, completed with this one. */
+} BlockRequest_t;
+
+/// @brief Driver of a block device.
+typedef struct BLOCK_DEVICE
+{
+    /// Start transferring a request and the ones merged to it, the driver calls block_complete once it is done.
+    void (*start)(BlockRequest_t *request);
+    uint32_t maxSectors;    /* Sectors a single command of merged requests can move, 0 disables merging. */
+} BlockDevice_t;
+
+/// @brief Register the device requests are sent to.
+/// @param device Device driver.
+void block_register(BlockDevice_t *device);
+
+/// @brief Queue a request without waiting for it, pending requests are sent to the device sorted by sector.
+/// @param request Request to queue, must stay valid until it is done.
+void block_submit(BlockRequest_t *request);
+
+/// @brief Wait for a submitted request, the current process sleeps until it is done.
+/// @param request Submitted request.
+/// @return true if the transfer succeeded, false, otherwise.
+bool block_wait(BlockRequest_t *request);
+
+/// @brief Complete the request being transferred, called by the driver.
+/// @param request Finished request, along with the requests merged to it.
+/// @param success Did the transfer succeed.
+void block_complete(BlockRequest_t *request, const bool success);
+
+/// @brief Read sectors from the block device.
+/// @param sector First sector to read from.
+/// @param buffer Buffer to read to.
+/// @param count Count of sectors.
+/// @return true if successfully read, false, otherwise.
+bool block_read(const uint64_t sector, void *buffer, const uint32_t count);
+
+/// @brief Write sectors to the block device.
+/// @param sector First sector to write to.
+/// @param buffer Buffer to write from.
+/// @param count Count of sectors.
+/// @return true if successfully written, false, otherwise.
+bool block_write(const uint64_t sector, const void *buffer, const uint32_t count);
+
+/// @brief Write the cache of the block device to the disk, after every request submitted before.
+/// @return true if successfully flushed, false, otherwise.
+bool block_flush();
\ No newline at end of file
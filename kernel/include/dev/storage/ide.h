@@ -22,6 +22,11 @@
 
 #define ATA_CMD_READ_PIO          0x20
 #define ATA_CMD_READ_PIO_EXT      0x24
+#define ATA_CMD_READ_MULTIPLE     0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_MULTIPLE    0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_SET_MULTIPLE      0xC6
 #define ATA_CMD_READ_DMA          0xC8
 #define ATA_CMD_READ_DMA_EXT      0x25
 #define ATA_CMD_WRITE_PIO         0x30
@@ -43,6 +48,7 @@
 #define ATA_IDENT_SECTORS      12
 #define ATA_IDENT_SERIAL       20
 #define ATA_IDENT_MODEL        54
+#define ATA_IDENT_MAX_MULTIPLE 94
 #define ATA_IDENT_CAPABILITIES 98
 #define ATA_IDENT_FIELDVALID   106
 #define ATA_IDENT_MAX_LBA      120
@@ -82,6 +88,27 @@
 #define ATA_SECTOR_SIZE         512
 #define ATA_WSECTOR_SIZE        (ATA_SECTOR_SIZE / 2)
 #define ATA_DEVICE              0x1F0
+#define ATA_LBA28_LIMIT         (1ULL << 28)
+#define ATA_LBA28_MAX_SECTORS   256
+#define ATA_LBA48_MAX_SECTORS   65536
+#define ATA_LBA48_SUPPORTED     (1 << 10)   /* In the second word of the identify command sets. */
+#define ATA_SECONDARY_DEVICE    0x170
+
+#define BM_REG_COMMAND          0x00
+#define BM_REG_STATUS           0x02
+#define BM_REG_PRDT             0x04
+#define BM_SECONDARY_OFFSET     0x08
+
+#define BM_CMD_START            0x01
+#define BM_CMD_READ             0x08    /* Device to memory */
+
+#define BM_SR_ACTIVE            0x01
+#define BM_SR_ERR               0x02
+#define BM_SR_INTERRUPT         0x04
+
+#define PRD_END_OF_TABLE        0x8000
+#define IDE_DMA_PAGES           16      /* A single PRD covers up to 64KB that don't cross a 64KB boundary */
+#define IDE_DMA_SECTORS         (IDE_DMA_PAGES * PAGE_SIZE / ATA_SECTOR_SIZE)
 
 typedef struct
 {
@@ -125,20 +152,31 @@ typedef struct
     uint16_t unused7[152];
 } __PACKED__ ata_identify_t;
 
+typedef struct
+{
+    uint32_t address;
+    uint16_t size;      /* 0 means 64KB */
+    uint16_t flags;
+} __PACKED__ prd_t;
+
 /// @brief Initialize the IDE controller.
 /// @param bus Bus of the controller.
 void ide_init(const uint16_t bus);
 
-/// @brief Read a sector from the disk.
-/// @param sector Sector to read from.
+/// @brief Read sectors from the disk.
+/// @param sector First sector to read from.
 /// @param buffer Buffer to read to.
 /// @param count Count of sectors.
 /// @return true if successfully read from the disk, false, otherwise.
-bool ide_read(uint32_t sector, void *buffer, const uint32_t count);
+bool ide_read(uint64_t sector, void *buffer, const uint32_t count);
 
-/// @brief Write a sector to the disk.
-/// @param sector Sector to write from.
+/// @brief Write sectors to the disk, they may stay in the cache of the drive until ide_flush.
+/// @param sector First sector to write to.
 /// @param buffer Buffer to write from.
 /// @param count Count of sectors.
 /// @return true if successfully wrote to the disk, false, otherwise.
-bool ide_write(uint32_t sector, void *buffer, const uint32_t count);
\ No newline at end of file
+bool ide_write(uint64_t sector, void *buffer, const uint32_t count);
+
+/// @brief Write the cache of the drive to the disk.
+/// @return true if successfully flushed, false, otherwise.
+bool ide_flush();
\ No newline at end of file
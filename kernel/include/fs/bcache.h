@@ -0,0 +1,69 @@
+#pragma once
+
+#include <common.h>
+#include <dev/storage/block.h>
+
+#define BCACHE_SIZE         (1 * _MB)   /* Maximum memory held by block data. */
+#define BCACHE_BUCKETS      128
+#define BCACHE_DIRTY_LIMIT  64          /* Dirty buffers allowed before a write back of all of them. */
+
+/// @brief Cached copy of a single filesystem block.
+typedef struct BUFFER_HEAD
+{
+    uint32_t block;
+    uint32_t refCount;
+    bool dirty;
+    bool valid;                 /* Data holds the contents of the block. */
+    bool loading;               /* A queued read of the block is in flight. */
+    uint8_t *data;
+    struct BUFFER_HEAD *hashNext;
+    struct BUFFER_HEAD *lruNext;
+    struct BUFFER_HEAD *lruPrev;
+    BlockRequest_t request;     /* Read ahead or write back of the buffer. */
+} BufferHead_t;
+
+/// @brief Initialize the block buffer cache.
+/// @param blockSize Size of a block in bytes.
+void bcache_init(const uint32_t blockSize);
+
+/// @brief Get a block from the cache, reading it from the disk if it isn't cached.
+/// @param block Block number.
+/// @param read Read the block from the disk on a miss, false if the caller overwrites the whole block.
+/// @return Referenced buffer of the block, NULL if failed.
+BufferHead_t *bcache_get(const uint32_t block, const bool read);
+
+/// @brief Start reading a block into the cache without waiting for it.
+/// @param block Block number.
+void bcache_prefetch(const uint32_t block);
+
+/// @brief Release a buffer returned by bcache_get.
+/// @param bh Buffer to release.
+void bcache_release(BufferHead_t *bh);
+
+/// @brief Mark a buffer as modified, it will be written back to the disk later.
+/// @param bh Buffer to mark.
+void bcache_markDirty(BufferHead_t *bh);
+
+/// @brief Read a whole block through the cache.
+/// @param block Block number.
+/// @param buffer Buffer to read to.
+/// @return true if successfully read, false, otherwise.
+bool bcache_read(const uint32_t block, void *buffer);
+
+/// @brief Read contiguous blocks, the ones missing from the cache are read with batched requests.
+/// @param block First block number.
+/// @param count Count of blocks.
+/// @param buffer Buffer to read to.
+/// @param direct Transfer missing blocks straight to the buffer without caching them.
+/// @return true if successfully read, false, otherwise.
+bool bcache_readBlocks(const uint32_t block, const uint32_t count, void *buffer, const bool direct);
+
+/// @brief Write a whole block through the cache.
+/// @param block Block number.
+/// @param buffer Buffer to write from.
+/// @return true if successfully written, false, otherwise.
+bool bcache_write(const uint32_t block, const void *buffer);
+
+/// @brief Write every dirty buffer back to the disk and flush the cache of the drive.
+/// @return true if all buffers were written, false, otherwise.
+bool bcache_flush();
\ No newline at end of file
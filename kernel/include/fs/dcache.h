@@ -0,0 +1,35 @@
+#pragma once
+
+#include <common.h>
+
+#define DCACHE_SIZE         256
+#define DCACHE_BUCKETS      64
+#define DCACHE_NEGATIVE     0   /* Inode of an entry caching a missing name. */
+
+/// @brief Cached result of a name lookup in a directory.
+typedef struct DENTRY
+{
+    uint32_t parent;
+    uint32_t ino;
+    struct DENTRY *hashNext;
+    struct DENTRY *lruNext;
+    struct DENTRY *lruPrev;
+    char name[];
+} Dentry_t;
+
+/// @brief Look up a name in the dentry cache.
+/// @param parent Inode of the parent directory.
+/// @param name Name of the entry.
+/// @param ino Found inode, DCACHE_NEGATIVE if the name is known to be missing.
+/// @return true if the entry is cached, false, otherwise.
+bool dcache_lookup(const uint32_t parent, const char *name, uint32_t *ino);
+
+/// @brief Insert the result of a lookup to the dentry cache.
+/// @param parent Inode of the parent directory.
+/// @param name Name of the entry.
+/// @param ino Inode of the entry, DCACHE_NEGATIVE if the name is missing.
+void dcache_insert(const uint32_t parent, const char *name, const uint32_t ino);
+
+/// @brief Drop every cached entry of a directory.
+/// @param parent Inode of the directory.
+void dcache_invalidate(const uint32_t parent);
\ No newline at end of file
@@ -4,6 +4,21 @@
 
 #define EXT2_SIGNATURE          0xEF53
 #define EXT2_MAX_NAME           255
+#define EXT2_INODE_CACHE_SIZE   128
+#define EXT2_INODE_BUCKETS      64
+#define EXT2_READAHEAD_MIN      4       /* Blocks read ahead once a file is read sequentially. */
+#define EXT2_READAHEAD_MAX      32
+#define EXT2_EXTENT_CACHE_SIZE  8       /* Runs of block mappings remembered per inode. */
+#define EXT2_PREALLOC_BLOCKS    8       /* Contiguous blocks reserved when a file grows. */
+
+#define EXT2_INDEX_FL           0x1000  /* Directory is indexed with an htree */
+#define EXT2_FLAGS_UNSIGNED_HASH 0x2
+
+#define DX_HASH_LEGACY          0
+#define DX_HASH_HALF_MD4        1
+#define DX_HASH_TEA             2
+#define DX_HASH_UNSIGNED_DELTA  3       /* Added to the version when names hash as unsigned chars */
+#define DX_MAX_LEVELS           3
 
 #define	EXT2_NDIR_BLOCKS		12
 #define	EXT2_IND_BLOCK			EXT2_NDIR_BLOCKS
@@ -111,7 +126,15 @@ typedef struct SUPERBLOCK
     uint16_t	s_reserved_word_pad;
     uint32_t	s_default_mount_opts;
     uint32_t	s_first_meta_bg; 	/* First metablock block group */
-    uint32_t	s_reserved[190];	/* Padding to the end of the block */
+    uint32_t	s_mkfs_time;		/* When the filesystem was created */
+    uint32_t	s_jnl_blocks[17]; 	/* Backup of the journal inode */
+    uint32_t	s_blocks_count_hi;	/* Blocks count */
+    uint32_t	s_r_blocks_count_hi;	/* Reserved blocks count */
+    uint32_t	s_free_blocks_hi; 	/* Free blocks count */
+    uint16_t	s_min_extra_isize;	/* All inodes have at least # bytes */
+    uint16_t	s_want_extra_isize; 	/* New inodes should reserve # bytes */
+    uint32_t	s_flags;		/* Miscellaneous flags */
+    uint32_t	s_reserved[167];	/* Padding to the end of the block */
 } __PACKED__ SuperBlock_t;
 
 typedef struct BLOCK_GROUP_DESCRIPTOR
@@ -198,6 +221,78 @@ typedef struct DIRECTORY
     char	    name[];			/* File name, up to EXT2_NAME_LEN */
 } __PACKED__ Directory_t;
 
+typedef struct DX_ROOT_INFO
+{
+    uint32_t    reserved_zero;
+    uint8_t     hash_version;
+    uint8_t     info_length;    /* 8 */
+    uint8_t     indirect_levels;
+    uint8_t     unused_flags;
+} __PACKED__ DxRootInfo_t;
+
+typedef struct DX_ENTRY
+{
+    uint32_t    hash;           /* Holds the limit and count in the first entry of a node */
+    uint32_t    block;
+} __PACKED__ DxEntry_t;
+
+typedef struct DX_COUNT_LIMIT
+{
+    uint16_t    limit;
+    uint16_t    count;
+} __PACKED__ DxCountLimit_t;
+
+/// @brief Entry of the in-memory name index of a directory.
+typedef struct DIR_INDEX_ENTRY
+{
+    uint32_t ino;
+    struct DIR_INDEX_ENTRY *hashNext;
+    char name[];
+} DirIndexEntry_t;
+
+/// @brief In-memory name index of a directory, entries are kept in on-disk order.
+typedef struct DIR_INDEX
+{
+    uint32_t count;
+    uint32_t capacity;
+    DirIndexEntry_t **entries;
+    uint32_t bucketCount;
+    DirIndexEntry_t **buckets;
+} DirIndex_t;
+
+/// @brief Run of file blocks stored in contiguous disk blocks.
+typedef struct BLOCK_EXTENT
+{
+    uint32_t block;     /* First file block. */
+    uint32_t real;      /* Disk block of the first file block. */
+    uint32_t count;
+} BlockExtent_t;
+
+/// @brief Free blocks kept for a file to grow into, only marked in the bitmap once they're used.
+typedef struct BLOCK_RESERVATION
+{
+    uint32_t block;         /* Next reserved block the file grows into. */
+    uint32_t count;
+    struct BLOCK_RESERVATION *next;
+} BlockReservation_t;
+
+/// @brief In-memory copy of an inode.
+typedef struct CACHED_INODE
+{
+    uint32_t ino;
+    uint32_t refCount;
+    bool dirty;
+    DirIndex_t *dirIndex;   /* Built on first access of a directory. */
+    uint32_t extentCount;
+    uint32_t extentHand;    /* Next extent replaced once all are used. */
+    BlockExtent_t extents[EXT2_EXTENT_CACHE_SIZE];
+    BlockReservation_t prealloc;
+    struct CACHED_INODE *hashNext;
+    struct CACHED_INODE *lruNext;
+    struct CACHED_INODE *lruPrev;
+    Inode_t inode;      /* Must be last, holds s_inode_size bytes. */
+} CachedInode_t;
+
 /// @brief Initialize the ext2 filesystem.
 void ext2_init();
 
@@ -231,12 +326,26 @@ void ext2_close(VfsNode_t *node);
 /// @param index Index in the directory to read.
 struct dirent *ext2_readdir(VfsNode_t *node, uint32_t index);
 
+/// @brief Read the next entries of a directory.
+/// @param node Directory to read from, its offset is the position in the directory.
+/// @param dirents Entries to read to.
+/// @param count Maximum amount of entries.
+/// @return Amount of entries read, negative errno otherwise.
+ssize_t ext2_getdents(VfsNode_t *node, struct dirent *dirents, size_t count);
+
 /// @brief Find an entry in a directory.
 /// @param node Directory to search in.
 /// @param name Name of the file to search for.
 /// @return Found file, NULL, otherwise.
 VfsNode_t *ext2_finddir(VfsNode_t *node, const char *name);
 
+/// @brief Get the node of an entry in a directory.
+/// @param node Directory of the entry.
+/// @param ino Inode of the entry.
+/// @param name Name of the entry.
+/// @return Node of the entry, NULL, otherwise.
+VfsNode_t *ext2_getnode(VfsNode_t *node, uint32_t ino, const char *name);
+
 /// @brief Create a file.
 /// @param node Parent directory node.
 /// @param name Name of the file.
@@ -254,4 +363,13 @@ int ext2_mkdir(VfsNode_t *node, const char *name, uint32_t attr);
 /// @brief Delete a directory.
 /// @param node Node of the parent directory.
 /// @param name Name of the file to delete.
-int ext2_delete(VfsNode_t *node, const char *name);
\ No newline at end of file
+int ext2_delete(VfsNode_t *node, const char *name);
+
+/// @brief Write every modified inode and block to the disk.
+/// @return Status of the operation.
+int ext2_sync();
+
+/// @brief Write a file and its metadata to the disk.
+/// @param node File to synchronize.
+/// @return Status of the operation.
+int ext2_fsync(VfsNode_t *node);
\ No newline at end of file
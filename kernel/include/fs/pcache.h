@@ -0,0 +1,44 @@
+#pragma once
+
+#include <fs/vfs.h>
+
+#define PCACHE_SIZE     (16 * _MB)  /* Maximum memory held by unmapped pages. */
+#define PCACHE_BUCKETS  256
+
+/// @brief Cached page of a file, mapped directly into processes.
+typedef struct CACHED_PAGE
+{
+    uint32_t ino;
+    uint32_t index;         /* Page index in the file. */
+    uint32_t refCount;      /* Mappings of the page. */
+    uint32_t valid;         /* Bytes at the start of the page holding the file's contents. */
+    bool stale;             /* File was deleted, freed once it's no longer mapped. */
+    void *frame;
+    struct CACHED_PAGE *hashNext;
+    struct CACHED_PAGE *lruNext;
+    struct CACHED_PAGE *lruPrev;
+} CachedPage_t;
+
+/// @brief Get a page of a file, reading it if it isn't cached.
+/// @param node File of the page, read from without changing the offset of the caller.
+/// @param index Page index in the file.
+/// @return Referenced frame of the page, NULL if failed.
+void *pcache_get(VfsNode_t *node, const uint32_t index);
+
+/// @brief Release a page returned by pcache_get.
+/// @param ino Inode of the file.
+/// @param index Page index in the file.
+/// @param frame Frame of the page.
+/// @return true if the frame belongs to the page cache, false, otherwise.
+bool pcache_put(const uint32_t ino, const uint32_t index, void *frame);
+
+/// @brief Copy written data to the cached pages of a file.
+/// @param ino Inode of the file.
+/// @param offset Offset the data was written to.
+/// @param size Amount of bytes written.
+/// @param buffer Written data.
+void pcache_update(const uint32_t ino, const uint32_t offset, const size_t size, const void *buffer);
+
+/// @brief Drop the pages of a deleted file, mapped pages are freed once unmapped.
+/// @param ino Inode of the file.
+void pcache_invalidate(const uint32_t ino);
\ No newline at end of file
@@ -7,6 +7,7 @@
 #define FS_PATH_SEPERATOR_STR   "/"
 #define FS_PATH_CURR_DIR        "."
 #define FS_PATH_UP_DIR          ".."
+#define DIR_BUFFER_ENTRIES      8
 
 #define FS_FILE     0x1
 #define FS_DIR      0x2
@@ -48,6 +49,7 @@
 #define	O_CREAT		0x0200		/* create if nonexistent */
 #define	O_TRUNC		0x0400		/* truncate to zero length */
 #define	O_EXCL		0x0800		/* error if already exists */
+#define	O_DIRECT	0x1000		/* read whole blocks straight from the disk */
 
 typedef struct VFS_NODE VfsNode_t;
 
@@ -57,9 +59,12 @@ typedef void (*open_type_t)(VfsNode_t *, uint32_t);
 typedef void (*close_type_t)(VfsNode_t *);
 typedef struct dirent *(*readdir_type_t)(VfsNode_t *, uint32_t);
 typedef VfsNode_t *(*finddir_type_t)(VfsNode_t *, const char *);
+typedef VfsNode_t *(*getnode_type_t)(VfsNode_t *, uint32_t, const char *);
+typedef ssize_t (*getdents_type_t)(VfsNode_t *, struct dirent *, size_t);
 typedef int (*create_type_t)(VfsNode_t *, const char *, uint32_t);
 typedef int (*mkdir_type_t)(VfsNode_t *, const char *, uint32_t);
 typedef int (*delete_type_t)(VfsNode_t *, const char *);
+typedef int (*fsync_type_t)(VfsNode_t *);
 
 struct VFS_NODE
 {
@@ -73,6 +78,10 @@ struct VFS_NODE
     uint32_t size;
     long offset;
     
+    uint32_t raOffset;  /* Offset a sequential read continues from. */
+    uint32_t raEnd;     /* Block following the blocks read ahead. */
+    uint32_t raWindow;  /* Blocks read ahead of a sequential reader. */
+    
     uint32_t atime;
     uint32_t mtime;
     uint32_t ctime;
@@ -83,9 +92,12 @@ struct VFS_NODE
     close_type_t close;
     readdir_type_t readdir;
     finddir_type_t finddir;
+    getnode_type_t getnode;
+    getdents_type_t getdents;
     create_type_t create;
     mkdir_type_t mkdir;
     delete_type_t delete;
+    fsync_type_t fsync;
 };
 
 typedef struct dirent
@@ -98,6 +110,8 @@ typedef struct DIR
 {
     uint32_t fd;
     size_t currentEntry;
+    size_t bufferedEntries;
+    struct dirent entries[DIR_BUFFER_ENTRIES];
 } DIR;
 
 extern VfsNode_t *_RootFS;
@@ -150,6 +164,13 @@ struct dirent *vfs_readdir(VfsNode_t *node, uint32_t index);
 /// @return Found file, NULL, otherwise.
 VfsNode_t *vfs_finddir(VfsNode_t *node, const char *name);
 
+/// @brief Read the next entries of a directory, continuing from the offset of the node.
+/// @param node Directory to read from.
+/// @param buffer Buffer to read the entries to.
+/// @param size Size of the buffer in bytes.
+/// @return Bytes read, 0 at the end of the directory, negative errno otherwise.
+ssize_t vfs_getdents(VfsNode_t *node, struct dirent *buffer, size_t size);
+
 /// @brief Create a file.
 /// @param name Name of the file.
 /// @param attr Attributes of the file.
@@ -175,4 +196,9 @@ int vfs_fseek(VfsNode_t *node, long offset, int whence);
 
 /// @brief Delete a file.
 /// @param name Name of the file to delete.
-int vfs_delete(const char *name);
\ No newline at end of file
+int vfs_delete(const char *name);
+
+/// @brief Write the modified data of a file to the disk.
+/// @param node File to synchronize.
+/// @return 0 on success, negative errno otherwise.
+int vfs_fsync(VfsNode_t *node);
\ No newline at end of file
@@ -53,6 +53,16 @@ void insm(const uint16_t port, uint8_t *data, uint32_t size);
 /// @brief Enable interrupts.
 #define __STI()     { asm volatile("sti" ::: "memory"); }
 
+/// @brief Disable interrupts and get the previous flags.
+#define __SAVE_INTERRUPTS() ({                                          \
+    uint64_t __flags;                                                   \
+    asm volatile("pushfq; pop %0; cli" : "=r"(__flags) : : "memory");   \
+    __flags;                                                            \
+})
+
+/// @brief Restore the interrupt flag saved by __SAVE_INTERRUPTS.
+#define __RESTORE_INTERRUPTS(flags) { if ((flags) & 0x200) __STI(); }
+
 /// @brief Halt the processor.
 #define __HALT()    { asm volatile("hlt" ::: "memory"); }
 
@@ -3,8 +3,11 @@
 #include <common.h>
 
 #define KERNEL_HEAP_START       0xFFFFFFFF80000000ULL
-#define KERNEL_HEAP_SIZE        (1024 * PAGE_SIZE)
-#define KERNEL_HEAP_END         (KERNEL_HEAP_START + KERNEL_HEAP_SIZE)
+#define KERNEL_HEAP_MAX_SIZE    (512 * _MB)
+#define KERNEL_HEAP_END         (KERNEL_HEAP_START + KERNEL_HEAP_MAX_SIZE)
+#define KERNEL_HEAP_INITIAL     (64 * PAGE_SIZE)
+#define KERNEL_HEAP_GROW        (64 * PAGE_SIZE)
+#define KERNEL_HEAP_TRIM        (4 * KERNEL_HEAP_GROW)
 
 /// @brief Initialize the heap.
 void heap_init();
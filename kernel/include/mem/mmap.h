@@ -0,0 +1,44 @@
+#pragma once
+
+#include <fs/vfs.h>
+
+#define MMAP_START      0x600000000000ULL   /* Mappings are placed upwards from here. */
+
+#define PROT_NONE       0x0
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+
+#define MAP_SHARED      0x1
+#define MAP_PRIVATE     0x2
+
+struct PROCESS;
+
+/// @brief File mapped into the address space of a process.
+typedef struct MEMORY_MAPPING
+{
+    uint64_t start;
+    uint64_t pages;
+    uint32_t index;     /* Page index in the file of the first page. */
+    int prot;
+    int flags;
+    VfsNode_t *node;    /* Private copy of the mapped file, stays valid after it's closed. */
+    struct MEMORY_MAPPING *next;
+} MemoryMapping_t;
+
+/// @brief Check if an address is inside a mapping of a process.
+/// @param process Process to check.
+/// @param addr Virtual address.
+/// @return true if the address is mapped from a file, false, otherwise.
+bool mmap_contains(struct PROCESS *process, const uint64_t addr);
+
+/// @brief Map the page of a file an access faulted on.
+/// @param process Process that faulted.
+/// @param addr Faulting address.
+/// @param write Was the access a write.
+/// @return true if the page was mapped, false if the access isn't allowed.
+bool mmap_fault(struct PROCESS *process, const uint64_t addr, const bool write);
+
+/// @brief Unmap every mapping of a process.
+/// @param process Process to unmap.
+void mmap_releaseAll(struct PROCESS *process);
\ No newline at end of file
@@ -1,8 +1,19 @@
 #pragma once
 
 #include <bootinfo.h>
+#include <common.h>
 
 #define MMAP_FREE 7
+#define PMM_MAX_ORDER 11     /* Largest block is 2^PMM_MAX_ORDER frames. */
+#define PMM_FRAME_CACHE_SIZE 32
+#define PMM_ZEROED_POOL_SIZE 256
+
+/// @brief Per-CPU stack of free frames.
+typedef struct FRAME_CACHE
+{
+    uint64_t count;
+    void *frames[PMM_FRAME_CACHE_SIZE];
+} FrameCache_t;
 
 /// @brief Initialize the physical memory manager.
 /// @param mmap Memory map.
@@ -15,8 +26,16 @@ void pmm_init(MemoryDescriptor_t *mmap, const uint64_t mmapSize, const uint64_t
 /// @return Address of the page, NULL if failed.
 void *pmm_getFrame();
 
+/// @brief Allocate a zeroed physical page.
+/// @return Address of the page, NULL if failed.
+void *pmm_getZeroedFrame();
+
+/// @brief Zero a free frame and add it to the zeroed pool, called from the idle loop.
+/// @return True if a frame was added, false if the pool is full or out of memory.
+bool pmm_zeroFreeFrame();
+
 /// @brief Allocate contagious physical pages.
-/// @param count Amount of pages.
+/// @param count Amount of pages, at most 2^PMM_MAX_ORDER.
 /// @return Address of the pages, NULL if failed.
 void *pmm_getFrames(const size_t count);
 
@@ -41,4 +60,8 @@ void pmm_unreserveRegion(uint64_t start, const size_t pc);
 
 /// @brief Calculate memory size.
 /// @return Memory size in bytes.
-uint64_t pmm_getMemorySize();
\ No newline at end of file
+uint64_t pmm_getMemorySize();
+
+/// @brief Get the amount of free frames.
+/// @return Amount of free frames, excluding frames held by the per-CPU caches.
+uint64_t pmm_getFreeFrames();
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <common.h>
+#include <arch/lock.h>
+
+#define KERNEL_SLAB_START       0xFFFFFFFFC0000000ULL
+#define KERNEL_SLAB_SIZE        (256 * _MB)
+#define KERNEL_SLAB_END         (KERNEL_SLAB_START + KERNEL_SLAB_SIZE)
+
+#define KMEM_MAX_CACHES         16
+#define KMEM_CACHE_NAME         24
+#define KMEM_MAGAZINE_SIZE      16
+#define KMEM_OBJECT_ALIGN       16
+#define KMEM_MIN_CLASS          16
+#define KMEM_MAX_CLASS          1024
+
+#define IS_SLAB_ADDRESS(addr)   ((uint64_t)(addr) >= KERNEL_SLAB_START && (uint64_t)(addr) < KERNEL_SLAB_END)
+
+/// @brief Header of a slab page.
+typedef struct KMEM_SLAB
+{
+    struct KMEM_SLAB *next;
+    struct KMEM_SLAB *prev;
+    struct KMEM_CACHE *cache;
+    void *freeList;
+    uint32_t inUse;
+    bool partial;
+} KmemSlab_t;
+
+/// @brief Per-CPU stack of free objects of a single cache.
+typedef struct KMEM_MAGAZINE
+{
+    uint64_t rounds;
+    void *objects[KMEM_MAGAZINE_SIZE];
+} KmemMagazine_t;
+
+/// @brief Cache of fixed size objects.
+typedef struct KMEM_CACHE
+{
+    char name[KMEM_CACHE_NAME];
+    uint32_t id;
+    size_t objectSize;
+    size_t objectsPerSlab;
+    KmemSlab_t *partial;
+    lock_t lock;
+} KmemCache_t;
+
+/// @brief Initialize the slab allocator.
+void slab_init();
+
+/// @brief Create an object cache.
+/// @param name Name of the cache.
+/// @param size Size of every object in the cache.
+/// @return Created cache, NULL if failed.
+KmemCache_t *kmem_cache_create(const char *name, const size_t size);
+
+/// @brief Allocate an object from a cache.
+/// @param cache Cache to allocate from.
+/// @return Allocated object, NULL if failed.
+__MALLOC__ void *kmem_cache_alloc(KmemCache_t *cache);
+
+/// @brief Return an object to its cache.
+/// @param cache Cache the object was allocated from.
+/// @param obj Object to free.
+void kmem_cache_free(KmemCache_t *cache, void *obj);
+
+/// @brief Get the cache an object was allocated from.
+/// @param obj Object allocated by the slab allocator.
+/// @return Cache of the object.
+KmemCache_t *kmem_cache_of(void *obj);
+
+/// @brief Allocate from the general purpose size classes.
+/// @param size Size in bytes of allocated memory.
+/// @return Pointer to the allocated memory, NULL if the size is not served by the slab allocator.
+__MALLOC__ void *kmem_alloc(const size_t size);
+
+extern bool _SlabInitialized;   /* Is the slab allocator initialized. */
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <common.h>
+#include <arch/isr.h>
+
+#define USER_SPACE_END  0x800000000000ULL   /* End of the lower canonical half, user buffers lie below it. */
+
+/// @brief Check that the current process may access a buffer, faulting in the pages it doesn't have yet.
+/// @param addr Start of the buffer.
+/// @param size Size of the buffer in bytes.
+/// @param write Will the kernel write to the buffer.
+/// @return true if the whole buffer is accessible, false, otherwise.
+bool access_ok(const void *addr, const size_t size, const bool write);
+
+/// @brief Copy kernel data to a buffer of the current process.
+/// @param dst User buffer.
+/// @param src Kernel data.
+/// @param size Amount of bytes to copy.
+/// @return true if copied, false if the buffer isn't accessible or was unmapped during the copy.
+bool copy_to_user(void *dst, const void *src, const size_t size);
+
+/// @brief Copy a buffer of the current process to the kernel.
+/// @param dst Kernel buffer.
+/// @param src User buffer.
+/// @param size Amount of bytes to copy.
+/// @return true if copied, false if the buffer isn't accessible or was unmapped during the copy.
+bool copy_from_user(void *dst, const void *src, const size_t size);
+
+
+/// @brief Let a page fault of the kernel inside a user copy fail the copy.
+/// @param stack Stack of the fault, resumed at the end of the copy.
+/// @return true if the fault happened inside a user copy, false, otherwise.
+bool uaccess_fixup(InterruptStack_t *stack);
\ No newline at end of file
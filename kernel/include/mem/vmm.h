@@ -83,6 +83,12 @@ void vmm_switchTable(PageTable_t *pml4);
 /// @return Physical address the virtual one is mapped, NULL, otherwise.
 void *virt2phys(PageTable_t *pml4, void *virt);
 
+/// @brief Get the last level entry a virtual address is mapped by.
+/// @param pml4 Table to perform the operation on.
+/// @param virt Virtual address.
+/// @return Entry of the address, NULL if its page table doesn't exist.
+PageTableEntry_t *vmm_getEntry(PageTable_t *pml4, void *virt);
+
 /// @brief Map a physical address to a virtual one.
 /// @param pml4 Table to perform the operation on.
 /// @param phys Physical address.
@@ -102,6 +108,12 @@ void vmm_identityMapPage(PageTable_t *pml4, void *phys, const uint64_t attr);
 /// @return Physical address the page was mapped to, NULL if wasn't mapped.
 void *vmm_unmapPage(PageTable_t *pml4, void *virt);
 
+/// @brief Remove a page from the page table without releasing its frame.
+/// @param pml4 Table to perform the operation on.
+/// @param virt Virtual address to remove from the page table.
+/// @return Physical address the page was mapped to, NULL if wasn't mapped.
+void *vmm_detachPage(PageTable_t *pml4, void *virt);
+
 /// @brief Remove a page from the page table.
 /// @param pml4 Table to perform the operation on.
 /// @param virt Virtual address to remove from the page table.
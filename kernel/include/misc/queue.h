@@ -17,6 +17,6 @@ typedef struct QUEUE
 } Queue_t;
 
 Queue_t *queue_create();
-void queue_enqueue(Queue_t *q, void *data);
+bool queue_enqueue(Queue_t *q, void *data);
 void *queue_deqeueue(Queue_t *q);
 void queue_remove(Queue_t *q, void *data);
\ No newline at end of file
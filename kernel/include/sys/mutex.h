@@ -0,0 +1,22 @@
+#pragma once
+
+#include <sys/process.h>
+#include <arch/lock.h>
+
+#define MAKE_MUTEX(name) static Mutex_t name = { 0 }
+
+/// @brief Lock that puts contending processes to sleep instead of spinning.
+typedef struct MUTEX
+{
+    lock_t lock;
+    bool locked;
+    Process_t *waitHead, *waitTail;    /* Sleeping processes, in the order they arrived. */
+} Mutex_t;
+
+/// @brief Acquire a mutex, sleeping until it is released if needed.
+/// @param mutex Mutex to acquire.
+void mutex_acquire(Mutex_t *mutex);
+
+/// @brief Release a mutex and wake up the first process waiting for it.
+/// @param mutex Mutex to release.
+void mutex_release(Mutex_t *mutex);
\ No newline at end of file
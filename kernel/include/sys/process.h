@@ -2,6 +2,7 @@
 
 #include <sys/signal.h>
 #include <mem/vmm.h>
+#include <mem/mmap.h>
 #include <fs/vfs.h>
 #include <misc/queue.h>
 #include <misc/tree.h>
@@ -41,6 +42,15 @@ typedef struct PROCESS
     list_t *fdt;
     char name[MAX_PROCESS_NAME];
     char cwd[FS_MAX_PATH];
+    void *kernelStack;          /* Stack of the process inside the kernel, NULL for kernel processes. */
+    struct PROCESS *waitNext;   /* Next process sleeping on the same event. */
+    MemoryMapping_t *mappings;  /* Files mapped by mmap. */
+    uint64_t mmapNext;          /* Address of the next mapping. */
+    struct PROCESS *runNext;    /* Neighbours in the run queue of the priority. */
+    struct PROCESS *runPrev;
+    struct RUN_QUEUE *runQueue; /* Run queue holding the process, NULL if it isn't queued. */
+    volatile bool running;      /* A core runs the process or hasn't switched away from it yet. */
+    int core;                   /* Index of the core the process last ran on, -1 before it first runs. */
     int id;
     int priority;
     int time;
@@ -51,6 +61,10 @@ typedef struct PROCESS
 /// @return Idle process.
 Process_t *process_init();
 
+/// @brief Create an idle process for a core other than the BSP.
+/// @return Created process, NULL if failed.
+Process_t *process_createIdle();
+
 /// @brief Create a process.
 /// @param parent Parent process.
 /// @param name Name of the process.
@@ -5,6 +5,16 @@
 
 #define PROC_FILE_AT(fd)    ((VfsNode_t *)(list_find_index(currentProcess()->fdt, fd)->value))
 
+/// @brief Processes ready to run on a core.
+typedef struct RUN_QUEUE
+{
+    Process_t *heads[PROCESS_PRIORITIES_COUNT];
+    Process_t *tails[PROCESS_PRIORITIES_COUNT];
+    uint32_t bitmap;            /* Bit of every priority with queued processes. */
+    volatile uint32_t count;    /* Processes in all of the queues, read without the lock to balance the cores. */
+    lock_t lock;
+} RunQueue_t;
+
 /// @brief Initialize the scheduler.
 void scheduler_init();
 
@@ -16,6 +26,11 @@ void scheduler_add(Process_t *process);
 /// @param process Process to remove.
 void scheduler_remove(Process_t *process);
 
+/// @brief Put the current process to sleep until it's added back to the scheduler.
+/// The caller must disable interrupts before checking the event it sleeps on,
+/// interrupts stay disabled when the process wakes up.
+void scheduler_sleep();
+
 /// @brief Switch a process.
 /// @param process Process to switch to.
 void yield(Process_t *process);
@@ -15,6 +15,10 @@
 #define SYSCALL_CLOSEDIR    10
 #define SYSCALL_CHDIR       11
 #define SYSCALL_GETCWD      12
+#define SYSCALL_GETDENTS    13
+#define SYSCALL_FSYNC       14
+#define SYSCALL_MMAP        15
+#define SYSCALL_MUNMAP      16
 
 /// @brief Stop the current process.
 /// @param status Status to stop with.
@@ -22,4 +26,7 @@
 void sys_exit(int status);
 
 /// @brief Initialize syscalls.
-void syscalls_init();
\ No newline at end of file
+void syscalls_init();
+
+/// @brief Enable the SYSCALL instruction on the current core.
+void syscalls_initCore();
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <dev/pit.h>
 #include <io/io.h>
 #include <assert.h>
+#include <libc/string.h>
 #include <panic.h>
 #include <logger.h>
 
@@ -15,6 +16,8 @@
 #define CPUID_FEAT_ECX_X2APIC   (1 << 21)
 #define IA32_APIC_MSR_ENABLE    (1 << 11)
 #define LAPIC_NMI               (4 << 8)
+#define IA32_GS_BASE_MSR        0xC0000101
+#define IA32_KERNEL_GS_BASE_MSR 0xC0000102
 
 bool _ApicInitialized = false;
 uint32_t _BspID;
@@ -120,23 +123,27 @@ void apic_wakeup_core(const uint8_t id)
     }
 }
 
+void apic_set_core(CoreContext_t *core)
+{
+    // The kernel GS base is swapped in on every entry from user space
+    core->self = core;
+    __wrmsr(IA32_GS_BASE_MSR, (uint32_t)(uint64_t)core, (uint32_t)((uint64_t)core >> 32));
+    __wrmsr(IA32_KERNEL_GS_BASE_MSR, 0, 0);
+}
+
 CoreContext_t *currentCPU()
 {
-    uint32_t cid = apic_get_id();
-    for (uint32_t i = 0; i < _CoreCount; i++)
-    {
-        if (cid == _Cores[i].id)
-            return &_Cores[i];
-    }
-    
-    panic("Failed finding core with id %u\n", cid);
+    CoreContext_t *core;
+    asm volatile("mov %%gs:0, %0" : "=r"(core));
+    return core;
 }
 
 void apic_init()
 {
     _CoreCount = _MADT.coreCount;
-    uint64_t corePages = RNDUP(_CoreCount * sizeof(CoreContext_t), PAGE_SIZE);
+    uint64_t corePages = (_CoreCount * sizeof(CoreContext_t) + PAGE_SIZE - 1) / PAGE_SIZE;
     assert(_Cores = (CoreContext_t *)vmm_createIdentityPages(_KernelPML4, corePages, VMM_KERNEL_ATTRIBUTES));
+    memset(_Cores, 0, _CoreCount * sizeof(CoreContext_t));
     
     // Verify APIC is supported
     uint32_t unused, ecx, edx, lo, hi;
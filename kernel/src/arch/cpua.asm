@@ -22,4 +22,25 @@ x64_enable_cpu_features:
     ret
 .no_sse:
     mov rax, 0
+    ret
+
+global x64_zero_page
+x64_zero_page:
+    ; zero a page with non-temporal stores
+    xor rax, rax
+    mov rcx, 4096 / 64
+.loop:
+    movnti [rdi], rax
+    movnti [rdi + 8], rax
+    movnti [rdi + 16], rax
+    movnti [rdi + 24], rax
+    movnti [rdi + 32], rax
+    movnti [rdi + 40], rax
+    movnti [rdi + 48], rax
+    movnti [rdi + 56], rax
+    add rdi, 64
+    dec rcx
+    jnz .loop
+
+    sfence
     ret
\ No newline at end of file
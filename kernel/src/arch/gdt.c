@@ -1,6 +1,8 @@
 #include <arch/gdt.h>
 #include <arch/idt.h>
+#include <arch/apic/apic.h>
 #include <mem/vmm.h>
+#include <mem/heap.h>
 #include <assert.h>
 #include <libc/string.h>
 #include <logger.h>
@@ -21,12 +23,12 @@ static void setEntry(const uint8_t i, const uint32_t base, const uint32_t limit,
     entry->baseHigh = ((base >> 24) & 0xFF);
 }
 
-static void setTSS(const uint8_t i)
+static void setTSS(GDTBlock_t *block, const uint8_t i)
 {
-	TSSEntry_t *tss = (TSSEntry_t *)(&g_gdtBlock.tss);
+	TSSEntry_t *tss = (TSSEntry_t *)(&block->tss);
 	*tss = (TSSEntry_t) { .ioMapBase = 0xFFFF };
     
-	TSSDescriptor_t* tssDescriptor = (TSSDescriptor_t *)(g_gdtBlock.gdt + i);
+	TSSDescriptor_t* tssDescriptor = (TSSDescriptor_t *)(block->gdt + i);
 	*tssDescriptor = (TSSDescriptor_t)
     {
 		.limitLow = sizeof(TSSEntry_t),
@@ -39,33 +41,33 @@ static void setTSS(const uint8_t i)
 	};
 }
 
-static void setTssInterrupt(uint16_t interrupt, void *stack, uint64_t stackSize)
+static void setTssInterrupt(TSSEntry_t *tss, uint16_t interrupt, void *stack, uint64_t stackSize)
 {
-    g_gdtBlock.tss.ist[interrupt - 1] = (uint64_t)stack + stackSize;
+    tss->ist[interrupt - 1] = (uint64_t)stack + stackSize;
 }
 
-static void setTssRing(size_t i, void *stack, uint64_t stackSize)
+static void setTssRing(TSSEntry_t *tss, size_t i, void *stack, uint64_t stackSize)
 {
-    g_gdtBlock.tss.rsp[i] = (uint64_t)stack + stackSize;
+    tss->rsp[i] = (uint64_t)stack + stackSize;
 }
 
-void tssSetLate()
+static void tssSetLate(TSSEntry_t *tss)
 {
     void *kstack = vmm_createIdentityPages(_KernelPML4, KERNEL_STACK_SIZE / PAGE_SIZE, VMM_KERNEL_ATTRIBUTES);
     assert(kstack);
-    setTssRing(0, kstack, KERNEL_STACK_SIZE);
+    setTssRing(tss, 0, kstack, KERNEL_STACK_SIZE);
     
     void *irqStack = vmm_createIdentityPages(_KernelPML4, KERNEL_STACK_SIZE / PAGE_SIZE, VMM_KERNEL_ATTRIBUTES);
     assert(irqStack);
-    setTssInterrupt(IRQ_IST, irqStack, KERNEL_STACK_SIZE);
+    setTssInterrupt(tss, IRQ_IST, irqStack, KERNEL_STACK_SIZE);
     
     void *timerStack = vmm_createIdentityPages(_KernelPML4, KERNEL_STACK_SIZE / PAGE_SIZE, VMM_KERNEL_ATTRIBUTES);
     assert(timerStack);
-    setTssInterrupt(PIT_IST, timerStack, KERNEL_STACK_SIZE);
+    setTssInterrupt(tss, PIT_IST, timerStack, KERNEL_STACK_SIZE);
     
     void *ps2Stack = vmm_createIdentityPages(_KernelPML4, KERNEL_STACK_SIZE / PAGE_SIZE, VMM_KERNEL_ATTRIBUTES);
     assert(ps2Stack);
-    setTssInterrupt(PS2_KBD_IST, ps2Stack, KERNEL_STACK_SIZE);
+    setTssInterrupt(tss, PS2_KBD_IST, ps2Stack, KERNEL_STACK_SIZE);
     
     LOG("TSS Stacks. Kernel at %p, IRQ at %p, Timer at %p, PS2 kbd at %p\n", kstack, irqStack, timerStack, ps2Stack);
 }
@@ -77,7 +79,11 @@ void gdt_load()
     
     if (g_bspInitialized)
     {
-        x64_load_gdt(&g_gdt, GDT_KERNEL_CS, GDT_KERNEL_DS);
+        // Other cores load the copy the BSP prepared for them, a busy TSS can't be loaded twice
+        GDTBlock_t *block = currentCPU()->gdt;
+        GDT_t gdt = { .size = sizeof(block->gdt) - 1, .base = (uint64_t)block->gdt };
+        x64_load_gdt(&gdt, GDT_KERNEL_CS, GDT_KERNEL_DS);
+        x64_flush_tss(GDT_TSS_INDEX);
         return;
     }
     
@@ -85,9 +91,9 @@ void gdt_load()
     setEntry(0, 0, 0, 0, 0);                                    // Kernel null segment
     setEntry(1, 0, 0xFFFFFFFF, KERNEL_CODE_SEGMENT, 0xAF);      // Kernel code segment
     setEntry(2, 0, 0xFFFFFFFF, KERNEL_DATA_SEGMENT, 0xAF);      // Kernel data segment
-    setEntry(4, 0, 0xFFFFFFFF, USER_CODE_SEGMENT, 0xAF);        // User code segment
-    setEntry(5, 0, 0xFFFFFFFF, USER_DATA_SEGMENT, 0xAF);        // User data segment
-    setTSS(6);                                                  // TSS
+    setEntry(4, 0, 0xFFFFFFFF, USER_DATA_SEGMENT, 0xAF);        // User data segment
+    setEntry(5, 0, 0xFFFFFFFF, USER_CODE_SEGMENT, 0xAF);        // User code segment
+    setTSS(&g_gdtBlock, 6);                                     // TSS
 
     g_gdt.base = (uint64_t)g_gdtBlock.gdt;
     g_gdt.size = sizeof(g_gdtBlock.gdt) - 1;
@@ -95,6 +101,29 @@ void gdt_load()
     x64_load_gdt(&g_gdt, GDT_KERNEL_CS, GDT_KERNEL_DS);
     x64_flush_tss(GDT_TSS_INDEX);
     
-    tssSetLate();
+    tssSetLate(&g_gdtBlock.tss);
     g_bspInitialized = true;
+}
+
+void gdt_initCore(struct CORE_CONTEXT *core)
+{
+    if (core->id == _BspID)
+    {
+        core->gdt = &g_gdtBlock;
+        return;
+    }
+    
+    // Every core needs its own TSS for its kernel and interrupt stacks
+    GDTBlock_t *block = (GDTBlock_t *)kmalloc(sizeof(GDTBlock_t));
+    assert(block);
+    memcpy(block->gdt, g_gdtBlock.gdt, sizeof(block->gdt));
+    setTSS(block, 6);
+    tssSetLate(&block->tss);
+    
+    core->gdt = block;
+}
+
+void tss_setKernelStack(void *stack, const uint64_t stackSize)
+{
+    setTssRing(&currentCPU()->gdt->tss, 0, stack, stackSize);
 }
\ No newline at end of file
@@ -13,8 +13,7 @@ x64_load_gdt:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
-    mov ss, ax
+    mov ss, ax      ; gs keeps the base of the core
 
     ret
 
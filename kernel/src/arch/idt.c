@@ -51,6 +51,8 @@ void idt_load()
     
     setAttributes(TIMER_ISR, PIT_IST, 0);
     setAttributes(PS2_KBD_ISR, PS2_KBD_IST, 0);
+    setAttributes(ATA_PRIMARY_ISR, IRQ_IST, IDT_INTERRUPT_TYPE0);      // Wakes processes, mustn't be preempted
+    setAttributes(ATA_SECONDARY_ISR, IRQ_IST, IDT_INTERRUPT_TYPE0);
     setAttributes(SYSCALL_ISR, 0, IDT_INTERRUPT_TYPE3);
     
     g_idt.base = (uint64_t)g_idtEntries;
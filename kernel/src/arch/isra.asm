@@ -56,6 +56,12 @@ global interruptHandlers
 
 isr_common:
     cld
+    
+    ; entering from user space, switch to the gs base of the core
+    test qword [rsp + 24], 3
+    jz .kernel_entry
+    swapgs
+.kernel_entry:
     pushaq
 
     ; store current segments
@@ -68,7 +74,6 @@ isr_common:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
     mov rdi, rsp
     call isr_interrupt_handler
@@ -78,7 +83,6 @@ isr_common:
     mov ds, bx
     mov es, bx
     mov fs, bx
-    mov gs, bx
     
     ; restore registers
     popaq
@@ -91,6 +95,12 @@ isr_common:
     add rsp, 8      ; don't overwrite the return value
 .continue:
     add rsp, 16     ; remove interrupt number and error code    
+    
+    ; returning to user space, restore its gs base
+    test qword [rsp + 8], 3
+    jz .kernel_exit
+    swapgs
+.kernel_exit:
     iretq
 
 interruptHandlers:
@@ -1,6 +1,7 @@
 #include <arch/smp.h>
 #include <arch/apic/madt.h>
 #include <arch/apic/apic.h>
+#include <arch/gdt.h>
 #include <dev/pit.h>
 #include <mem/vmm.h>
 #include <io/io.h>
@@ -21,6 +22,7 @@ typedef struct CORE_LAUNCH_INFO
 
 uint32_t _CoreCount;
 CoreContext_t *_Cores;
+bool _CoresReady = false;
 
 #define AP_TIMEOUT_RETRY    10
 #define AP_TIMEOUT_MS       5
@@ -74,6 +76,7 @@ void smp_init()
         void *kstack = vmm_createIdentityPages(_KernelPML4, CORE_STACK_SIZE / PAGE_SIZE, VMM_KERNEL_ATTRIBUTES);
         assert(kstack);
         currentContext->stack = (uint64_t)kstack + CORE_STACK_SIZE;
+        gdt_initCore(currentContext);
                 
         coreInfo->context = (uint64_t)currentContext;
         coreInfo->pml4 = (uint32_t)(uint64_t)_KernelPML4;
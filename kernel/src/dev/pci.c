@@ -0,0 +1,55 @@
+#include <dev/pci.h>
+#include <io/io.h>
+
+#define CONFIG_ENABLE   0x80000000
+
+static uint32_t getAddress(const PciDevice_t *dev, const uint8_t offset)
+{
+    return CONFIG_ENABLE | ((uint32_t)dev->bus << 16) | ((uint32_t)dev->device << 11) | ((uint32_t)dev->function << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_read(const PciDevice_t *dev, const uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, getAddress(dev, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write(const PciDevice_t *dev, const uint8_t offset, const uint32_t value)
+{
+    outl(PCI_CONFIG_ADDRESS, getAddress(dev, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+bool pci_findClass(const uint8_t class, const uint8_t subclass, PciDevice_t *dev)
+{
+    for (uint32_t bus = 0; bus < PCI_MAX_BUS; bus++)
+    {
+        for (uint8_t device = 0; device < PCI_MAX_DEVICE; device++)
+        {
+            for (uint8_t function = 0; function < PCI_MAX_FUNCTION; function++)
+            {
+                PciDevice_t current = { .bus = bus, .device = device, .function = function };
+                if ((pci_read(&current, PCI_VENDOR_ID) & 0xFFFF) == PCI_NO_VENDOR)
+                {
+                    if (function == 0)
+                        break;  // No device in this slot
+
+                    continue;
+                }
+
+                uint32_t classReg = pci_read(&current, PCI_CLASS);
+                if ((classReg >> 24) == class && ((classReg >> 16) & 0xFF) == subclass)
+                {
+                    *dev = current;
+                    return true;
+                }
+
+                // Only multi-function devices implement functions other than 0
+                if (function == 0 && !(pci_read(&current, PCI_HEADER_TYPE) & 0x800000))
+                    break;
+            }
+        }
+    }
+
+    return false;
+}
\ No newline at end of file
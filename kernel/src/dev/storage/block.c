@@ -0,0 +1,231 @@
+#include <dev/storage/block.h>
+#include <sys/scheduler.h>
+#include <arch/lock.h>
+#include <io/io.h>
+#include <assert.h>
+
+#define REQUEST_END(request)    ((request)->sector + (request)->count)
+
+static BlockDevice_t *g_device = NULL;
+static BlockRequest_t *g_queue = NULL;      /* Waiting requests, sorted by sector between flushes. */
+static BlockRequest_t *g_active = NULL;     /* Request being transferred by the device. */
+static uint64_t g_headSector = 0;           /* Sector following the last transfer. */
+MAKE_SPINLOCK(g_lock);
+
+static BlockRequest_t **lastSegment()
+{
+    // Requests can't move before a flush, new ones are sorted after the last one
+    BlockRequest_t **segment = &g_queue;
+    for (BlockRequest_t **link = &g_queue; *link; link = &(*link)->next)
+    {
+        if ((*link)->flush)
+            segment = &(*link)->next;
+    }
+    
+    return segment;
+}
+
+static bool overlapsRead(BlockRequest_t *queued, const BlockRequest_t *request)
+{
+    for (; queued && queued->sector < REQUEST_END(request); queued = queued->next)
+    {
+        if (!queued->write && REQUEST_END(queued) > request->sector)
+            return true;
+    }
+    
+    return false;
+}
+
+static void insertRequest(BlockRequest_t *request)
+{
+    BlockRequest_t **link = lastSegment();
+    if (request->flush)
+    {
+        while (*link)
+            link = &(*link)->next;
+        
+        *link = request;
+        return;
+    }
+    
+    bool coalesce = request->write && !overlapsRead(*link, request);
+    while (*link && (*link)->sector <= request->sector)
+    {
+        // A newer write of the same sectors makes the queued one redundant
+        BlockRequest_t *queued = *link;
+        if (coalesce && queued->write && queued->sector == request->sector && queued->count == request->count)
+        {
+            *link = queued->next;
+            queued->next = NULL;
+            request->coalesced = queued;
+            continue;
+        }
+        
+        link = &queued->next;
+    }
+    
+    request->next = *link;
+    *link = request;
+}
+
+static BlockRequest_t *nextRequest()
+{
+    if (g_active || !g_queue)
+        return NULL;
+    
+    // Keep moving towards higher sectors, wrap around to the lowest at the end (C-LOOK).
+    // Only the requests before the first flush are considered
+    BlockRequest_t **link = &g_queue;
+    if (!g_queue->flush)
+    {
+        while (*link && !(*link)->flush && (*link)->sector < g_headSector)
+            link = &(*link)->next;
+        if (!*link || (*link)->flush)
+            link = &g_queue;
+    }
+    
+    BlockRequest_t *request = *link;
+    *link = request->next;
+    request->next = NULL;
+    
+    // Merge the following contiguous requests of the same direction into one transfer
+    BlockRequest_t *last = request;
+    uint32_t count = request->count;
+    while (!request->flush && *link && !(*link)->flush && (*link)->write == request->write &&
+           (*link)->sector == REQUEST_END(last) && count + (*link)->count <= g_device->maxSectors)
+    {
+        last->merged = *link;
+        last = *link;
+        *link = last->next;
+        last->next = NULL;
+        count += last->count;
+    }
+    
+    if (!request->flush)
+        g_headSector = REQUEST_END(last);
+    
+    g_active = request;
+    return request;
+}
+
+static void completeRequest(BlockRequest_t *request, const bool success)
+{
+    // The submitter may release the request once it's done
+    BlockRequest_t *coalesced = request->coalesced;
+    request_callback_t callback = request->callback;
+    
+    // A waiter on another core sets itself under the lock, so it's either seen here or sees the request done
+    lock_acquire(&g_lock);
+    Process_t *waiter = request->waiter;
+    request->success = success;
+    request->done = true;
+    lock_release(&g_lock);
+    
+    if (callback)
+        callback(request);
+    if (waiter)
+        scheduler_add(waiter);
+    if (coalesced)
+        completeRequest(coalesced, success);
+}
+
+void block_register(BlockDevice_t *device)
+{
+    g_device = device;
+}
+
+void block_submit(BlockRequest_t *request)
+{
+    assert(g_device);
+    request->done = false;
+    request->success = false;
+    request->waiter = NULL;
+    request->next = NULL;
+    request->merged = NULL;
+    request->coalesced = NULL;
+    
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&g_lock);
+    insertRequest(request);
+    BlockRequest_t *start = nextRequest();
+    lock_release(&g_lock);
+    
+    // Started outside of the lock, the driver may complete the request right away
+    if (start)
+        g_device->start(start);
+    
+    __RESTORE_INTERRUPTS(flags);
+}
+
+bool block_wait(BlockRequest_t *request)
+{
+    uint64_t flags = __SAVE_INTERRUPTS();
+    Process_t *current = currentProcess();
+    lock_acquire(&g_lock);
+    while (!request->done)
+    {
+        if (current && current->kernelStack)
+        {
+            request->waiter = current;
+            lock_release(&g_lock);
+            scheduler_sleep();
+        }
+        else
+        {
+            // Nothing to switch to before the scheduler runs, wait for the interrupt
+            lock_release(&g_lock);
+            __STI();
+            __HALT();
+            __CLI();
+        }
+        
+        lock_acquire(&g_lock);
+    }
+    
+    lock_release(&g_lock);
+    __RESTORE_INTERRUPTS(flags);
+    return request->success;
+}
+
+void block_complete(BlockRequest_t *request, const bool success)
+{
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&g_lock);
+    assert(request == g_active);
+    g_active = NULL;
+    BlockRequest_t *start = nextRequest();
+    lock_release(&g_lock);
+    
+    while (request)
+    {
+        BlockRequest_t *merged = request->merged;
+        completeRequest(request, success);
+        request = merged;
+    }
+    
+    if (start)
+        g_device->start(start);
+    
+    __RESTORE_INTERRUPTS(flags);
+}
+
+bool block_read(const uint64_t sector, void *buffer, const uint32_t count)
+{
+    BlockRequest_t request = { .sector = sector, .count = count, .write = false, .buffer = (uint8_t *)buffer };
+    block_submit(&request);
+    return block_wait(&request);
+}
+
+bool block_write(const uint64_t sector, const void *buffer, const uint32_t count)
+{
+    BlockRequest_t request = { .sector = sector, .count = count, .write = true, .buffer = (uint8_t *)buffer };
+    block_submit(&request);
+    return block_wait(&request);
+}
+
+bool block_flush()
+{
+    BlockRequest_t request = { .flush = true };
+    block_submit(&request);
+    return block_wait(&request);
+}
\ No newline at end of file
@@ -1,7 +1,29 @@
 #include <dev/storage/ide.h>
+#include <dev/storage/block.h>
+#include <dev/pci.h>
+#include <arch/isr.h>
+#include <mem/pmm.h>
+#include <mem/vmm.h>
 #include <io/io.h>
+#include <assert.h>
+#include <libc/string.h>
+#include <logger.h>
+
+#define PRDT_ENTRIES    (PAGE_SIZE / sizeof(prd_t))
+#define PRD_BOUNDARY    0x10000     /* Entries can't cross a 64KB boundary. */
 
 static uint16_t g_bus;
+static uint16_t g_bmBase;
+static prd_t *g_prdt;
+static uint32_t g_prdEntries;
+static uint8_t *g_dmaBuffer;                /* Used only for buffers the controller can't reach. */
+static bool g_bounce;                       /* The chunk being transferred goes through the DMA buffer. */
+static bool g_dmaEnabled = false;
+static bool g_lba48 = false;
+static uint32_t g_multipleSectors = 1;     /* Sectors moved per DRQ block by READ/WRITE MULTIPLE. */
+static BlockRequest_t *g_request = NULL;    /* Request being transferred by DMA. */
+static uint32_t g_requestSectors;           /* Sectors of the request and the ones merged to it. */
+static uint32_t g_requestDone;              /* Sectors already transferred. */
 
 static void ioWait()
 {
@@ -41,6 +63,345 @@ static void ataWaitReady()
     while (inb(g_bus + ATA_REG_STATUS) & ATA_SR_BSY) ;
 }
 
+static void initDMA()
+{
+    PciDevice_t dev;
+    if (!pci_findClass(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &dev))
+        return;
+    
+    uint32_t bar4 = pci_read(&dev, PCI_BAR4);
+    if (!(bar4 & PCI_BAR_IO))
+        return;
+    
+    // PRD table and buffer must be physically addressable with 32 bits
+    g_prdt = (prd_t *)pmm_getFrame();
+    g_dmaBuffer = (uint8_t *)pmm_getFrames(IDE_DMA_PAGES);
+    if (!g_prdt || !g_dmaBuffer || (uint64_t)g_prdt >= UINT32_MAX || (uint64_t)g_dmaBuffer + IDE_DMA_PAGES * PAGE_SIZE > UINT32_MAX)
+    {
+        if (g_prdt)
+            pmm_releaseFrame(g_prdt);
+        if (g_dmaBuffer)
+            pmm_releaseFrames(g_dmaBuffer, IDE_DMA_PAGES);
+        
+        return;
+    }
+    
+    // Enable bus mastering
+    pci_write(&dev, PCI_COMMAND, pci_read(&dev, PCI_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    g_bmBase = (bar4 & PCI_BAR_IO_MASK) + (g_bus == ATA_SECONDARY_DEVICE ? BM_SECONDARY_OFFSET : 0);
+    
+    g_dmaEnabled = true;
+    LOG("IDE bus master at 0x%x, fallback DMA buffer at %p\n", g_bmBase, g_dmaBuffer);
+}
+
+static void issueCommand(const uint64_t sector, const uint32_t count, const uint8_t cmd, const uint8_t cmdExt, const bool interrupt)
+{
+    outb(g_bus + ATA_REG_CONTROL, interrupt ? 0x00 : 0x02);
+    ataWaitReady();
+    
+    if (sector + count <= ATA_LBA28_LIMIT && count <= ATA_LBA28_MAX_SECTORS)
+    {
+        outb(g_bus + ATA_REG_HDDEVSEL,  0xe0 | 0 << 4 | 
+                                    (sector & 0x0f000000) >> 24);
+        outb(g_bus + ATA_REG_FEATURES, 0x00);
+        outb(g_bus + ATA_REG_SECCOUNT0, (uint8_t)count);    // 256 wraps to 0
+        outb(g_bus + ATA_REG_LBA0, (sector & 0x000000ff) >>  0);
+        outb(g_bus + ATA_REG_LBA1, (sector & 0x0000ff00) >>  8);
+        outb(g_bus + ATA_REG_LBA2, (sector & 0x00ff0000) >> 16);
+        outb(g_bus + ATA_REG_COMMAND, cmd);
+        return;
+    }
+    
+    // LBA48, the high bytes are written first to the same registers
+    outb(g_bus + ATA_REG_HDDEVSEL, 0x40);
+    outb(g_bus + ATA_REG_SECCOUNT0, (count >> 8) & 0xff);  // 65536 wraps to 0
+    outb(g_bus + ATA_REG_LBA0, (sector >> 24) & 0xff);
+    outb(g_bus + ATA_REG_LBA1, (sector >> 32) & 0xff);
+    outb(g_bus + ATA_REG_LBA2, (sector >> 40) & 0xff);
+    outb(g_bus + ATA_REG_SECCOUNT0, count & 0xff);
+    outb(g_bus + ATA_REG_LBA0, (sector >>  0) & 0xff);
+    outb(g_bus + ATA_REG_LBA1, (sector >>  8) & 0xff);
+    outb(g_bus + ATA_REG_LBA2, (sector >> 16) & 0xff);
+    outb(g_bus + ATA_REG_COMMAND, cmdExt);
+}
+
+static bool addRegion(uint8_t *buffer, uint32_t size)
+{
+    // The controller reads the table with physical addresses below 4GB, contiguous pages share an entry
+    while (size)
+    {
+        uint8_t *frame = (uint8_t *)virt2phys(_KernelPML4, buffer);
+        uint64_t phys = (uint64_t)frame + (uint64_t)buffer % PAGE_SIZE;
+        uint32_t part = MIN(size, PAGE_SIZE - (uint64_t)buffer % PAGE_SIZE);
+        if (!frame || phys % 2 || phys + part > UINT32_MAX)
+            return false;
+        
+        prd_t *last = g_prdEntries ? &g_prdt[g_prdEntries - 1] : NULL;
+        if (last && last->address + last->size == phys && phys % PRD_BOUNDARY)
+            last->size += part;     // 64KB wraps to 0
+        else if (g_prdEntries < PRDT_ENTRIES)
+            g_prdt[g_prdEntries++] = (prd_t){ .address = (uint32_t)phys, .size = (uint16_t)part, .flags = 0 };
+        else
+            return false;
+        
+        buffer += part;
+        size -= part;
+    }
+    
+    return true;
+}
+
+static bool mapBuffer(uint8_t *buffer, const uint32_t count)
+{
+    g_prdEntries = 0;
+    if (!addRegion(buffer, count * ATA_SECTOR_SIZE))
+        return false;
+    
+    g_prdt[g_prdEntries - 1].flags = PRD_END_OF_TABLE;
+    return true;
+}
+
+static void mapBounceBuffer(const uint32_t count)
+{
+    g_prdt[0] = (prd_t){ .address = (uint32_t)(uint64_t)g_dmaBuffer, .size = (uint16_t)(count * ATA_SECTOR_SIZE), .flags = PRD_END_OF_TABLE };
+    g_prdEntries = 1;
+}
+
+static void startDMA(const uint64_t sector, const uint32_t count, const bool write, const bool interrupt)
+{
+    outb(g_bmBase + BM_REG_COMMAND, 0);
+    outl(g_bmBase + BM_REG_PRDT, (uint32_t)(uint64_t)g_prdt);
+    outb(g_bmBase + BM_REG_STATUS, BM_SR_ERR | BM_SR_INTERRUPT);    // Write 1 to clear
+    outb(g_bmBase + BM_REG_COMMAND, write ? 0 : BM_CMD_READ);
+    
+    if (write)
+        issueCommand(sector, count, ATA_CMD_WRITE_DMA, ATA_CMD_WRITE_DMA_EXT, interrupt);
+    else
+        issueCommand(sector, count, ATA_CMD_READ_DMA, ATA_CMD_READ_DMA_EXT, interrupt);
+    
+    // The controller moves the data from here
+    outb(g_bmBase + BM_REG_COMMAND, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+}
+
+static bool finishDMA()
+{
+    uint8_t status = inb(g_bmBase + BM_REG_STATUS);
+    outb(g_bmBase + BM_REG_COMMAND, 0);
+    outb(g_bmBase + BM_REG_STATUS, BM_SR_ERR | BM_SR_INTERRUPT);
+    ataWaitReady();
+    
+    // Reading the status also acknowledges the interrupt of the drive
+    uint8_t ataStatus = inb(g_bus + ATA_REG_STATUS);
+    return !(status & BM_SR_ERR) && !(ataStatus & (ATA_SR_ERR | ATA_SR_DF));
+}
+
+static bool transferDMA(const uint64_t sector, const uint32_t count, const bool write)
+{
+    startDMA(sector, count, write, false);
+    
+    uint8_t status;
+    while (((status = inb(g_bmBase + BM_REG_STATUS)) & BM_SR_ACTIVE) && !(status & (BM_SR_ERR | BM_SR_INTERRUPT)))
+        __PAUSE();
+    
+    return finishDMA();
+}
+
+static bool readPIO(const uint64_t sector, uint8_t *buf, const uint32_t count)
+{
+    if (g_multipleSectors > 1)
+        issueCommand(sector, count, ATA_CMD_READ_MULTIPLE, ATA_CMD_READ_MULTIPLE_EXT, false);
+    else
+        issueCommand(sector, count, ATA_CMD_READ_PIO, ATA_CMD_READ_PIO_EXT, false);
+    
+    // The drive raises DRQ once for every block of sectors
+    for (uint32_t done = 0; done < count;)
+    {
+        if (ataWait(1))
+            return false;
+        
+        uint32_t sectors = MIN(count - done, g_multipleSectors);
+        insm(g_bus, buf + done * ATA_SECTOR_SIZE, sectors * ATA_WSECTOR_SIZE);
+        done += sectors;
+    }
+    
+    ataWait(0);
+    return true;
+}
+
+static bool writePIO(const uint64_t sector, uint8_t *buf, const uint32_t count)
+{
+    if (g_multipleSectors > 1)
+        issueCommand(sector, count, ATA_CMD_WRITE_MULTIPLE, ATA_CMD_WRITE_MULTIPLE_EXT, false);
+    else
+        issueCommand(sector, count, ATA_CMD_WRITE_PIO, ATA_CMD_WRITE_PIO_EXT, false);
+    
+    for (uint32_t done = 0; done < count;)
+    {
+        if (ataWait(1))
+            return false;
+        
+        uint32_t sectors = MIN(count - done, g_multipleSectors);
+        outsm(g_bus, buf + done * ATA_SECTOR_SIZE, sectors * ATA_WSECTOR_SIZE);
+        done += sectors;
+    }
+    
+    ataWait(0);
+    return true;
+}
+
+static void issueFlush(const bool interrupt)
+{
+    outb(g_bus + ATA_REG_CONTROL, interrupt ? 0x00 : 0x02);
+    ataWaitReady();
+    outb(g_bus + ATA_REG_COMMAND, g_lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+}
+
+static void setMultipleMode(const uint8_t sectors)
+{
+    if (sectors <= 1)
+        return;
+    
+    outb(g_bus + ATA_REG_HDDEVSEL, 0xe0);
+    outb(g_bus + ATA_REG_SECCOUNT0, sectors);
+    outb(g_bus + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    ataWait(0);
+    
+    if (!(inb(g_bus + ATA_REG_STATUS) & ATA_SR_ERR))
+        g_multipleSectors = sectors;
+}
+
+static bool mapRequests(const uint32_t count)
+{
+    // Map the next sectors of the request and the ones merged to it
+    g_prdEntries = 0;
+    uint32_t start = g_requestDone, end = g_requestDone + count, position = 0;
+    for (BlockRequest_t *request = g_request; request && position < end; request = request->merged)
+    {
+        uint32_t first = MAX(start, position), last = MIN(end, position + request->count);
+        if (first < last && !addRegion(request->buffer + (first - position) * ATA_SECTOR_SIZE, (last - first) * ATA_SECTOR_SIZE))
+            return false;
+        
+        position += request->count;
+    }
+    
+    g_prdt[g_prdEntries - 1].flags = PRD_END_OF_TABLE;
+    return true;
+}
+
+static void copyBounced(const uint32_t count, const bool toDevice)
+{
+    uint8_t *dma = g_dmaBuffer;
+    uint32_t start = g_requestDone, end = g_requestDone + count, position = 0;
+    for (BlockRequest_t *request = g_request; request && position < end; request = request->merged)
+    {
+        uint32_t first = MAX(start, position), last = MIN(end, position + request->count);
+        if (first < last)
+        {
+            uint8_t *buffer = request->buffer + (first - position) * ATA_SECTOR_SIZE;
+            size_t size = (last - first) * ATA_SECTOR_SIZE;
+            if (toDevice)
+                memcpy(dma, buffer, size);
+            else
+                memcpy(buffer, dma, size);
+            
+            dma += size;
+        }
+        
+        position += request->count;
+    }
+}
+
+static void startChunk()
+{
+    // The controller transfers straight from the buffers of the requests, the DMA buffer is only a fallback
+    uint32_t sectors = MIN(g_requestSectors - g_requestDone, IDE_DMA_SECTORS);
+    g_bounce = !mapRequests(sectors);
+    if (g_bounce)
+    {
+        mapBounceBuffer(sectors);
+        if (g_request->write)
+            copyBounced(sectors, true);
+    }
+    
+    startDMA(g_request->sector + g_requestDone, sectors, g_request->write, true);
+}
+
+static void startRequest(BlockRequest_t *request)
+{
+    if (request->flush && !g_dmaEnabled)
+    {
+        block_complete(request, ide_flush());
+        return;
+    }
+    if (request->flush)
+    {
+        g_request = request;
+        issueFlush(true);
+        return;
+    }
+    
+    uint32_t sectors = 0;
+    for (BlockRequest_t *merged = request; merged; merged = merged->merged)
+        sectors += merged->count;
+    
+    if (!g_lba48 && request->sector + sectors > ATA_LBA28_LIMIT)
+    {
+        block_complete(request, false);
+        return;
+    }
+    if (!g_dmaEnabled)
+    {
+        // Polled transfer, completes right away. Nothing is merged without DMA
+        bool success = request->write ? ide_write(request->sector, request->buffer, request->count) : ide_read(request->sector, request->buffer, request->count);
+        block_complete(request, success);
+        return;
+    }
+    
+    g_request = request;
+    g_requestSectors = sectors;
+    g_requestDone = 0;
+    startChunk();
+}
+
+static void interruptHandler(InterruptStack_t *stack)
+{
+    UNUSED(stack);
+    
+    BlockRequest_t *request = g_request;
+    if (request && request->flush)
+    {
+        uint8_t status = inb(g_bus + ATA_REG_STATUS);
+        outb(g_bmBase + BM_REG_STATUS, BM_SR_INTERRUPT);
+        
+        g_request = NULL;
+        block_complete(request, !(status & (ATA_SR_ERR | ATA_SR_DF)));
+        return;
+    }
+    if (!request || !(inb(g_bmBase + BM_REG_STATUS) & BM_SR_INTERRUPT))
+    {
+        inb(g_bus + ATA_REG_STATUS);
+        return;
+    }
+    
+    bool success = finishDMA();
+    uint32_t sectors = MIN(g_requestSectors - g_requestDone, IDE_DMA_SECTORS);
+    if (success && g_bounce && !request->write)
+        copyBounced(sectors, false);
+    
+    // Requests larger than a chunk continue from the interrupt
+    g_requestDone += sectors;
+    if (success && g_requestDone < g_requestSectors)
+    {
+        startChunk();
+        return;
+    }
+    
+    g_request = NULL;
+    block_complete(request, success);
+}
+
+static BlockDevice_t g_blockDevice = { .start = startRequest };
+
 void ide_init(const uint16_t bus)
 {
     g_bus = bus;
@@ -67,65 +428,93 @@ void ide_init(const uint16_t bus)
         ptr[i] = tmp;
     }
     outb(bus + ATA_REG_CONTROL, 0x02);
+    
+    // Word 83 of the command sets tells if the 48-bit feature set is supported
+    g_lba48 = (buf[ATA_IDENT_COMMANDSETS / 2 + 1] & ATA_LBA48_SUPPORTED) != 0;
+    setMultipleMode(buf[ATA_IDENT_MAX_MULTIPLE / 2] & 0xff);
+    LOG("IDE disk (LBA48 %s, %u sectors per DRQ block)\n", g_lba48 ? "on" : "off", g_multipleSectors);
+    
+    // DMA transfers complete from the interrupt, others are polled
+    initDMA();
+    if (g_dmaEnabled)
+    {
+        assert(isr_registerHandler(bus == ATA_SECONDARY_DEVICE ? ATA_SECONDARY_ISR : ATA_PRIMARY_ISR, interruptHandler));
+        g_blockDevice.maxSectors = IDE_DMA_SECTORS;     // Merged requests must fit in the DMA buffer if they fall back to it
+    }
+    
+    block_register(&g_blockDevice);
 }
 
-bool ide_read(uint32_t sector, void *buffer, const uint32_t count)
+bool ide_read(uint64_t sector, void *buffer, const uint32_t count)
 {
-    if (!buffer)
+    if (!buffer || (!g_lba48 && sector + count > ATA_LBA28_LIMIT))
         return false;
     
     uint8_t *buf = (uint8_t *)buffer;
-    for (uint32_t i = 0; i < count; i++)
+    if (g_dmaEnabled)
     {
-        outb(g_bus + ATA_REG_CONTROL, 0x02);
-        ataWaitReady();
-
-        outb(g_bus + ATA_REG_HDDEVSEL,  0xe0 | 0 << 4 | 
-                                    (sector & 0x0f000000) >> 24);
-        outb(g_bus + ATA_REG_FEATURES, 0x00);
-        outb(g_bus + ATA_REG_SECCOUNT0, 1);
-        outb(g_bus + ATA_REG_LBA0, (sector & 0x000000ff) >>  0);
-        outb(g_bus + ATA_REG_LBA1, (sector & 0x0000ff00) >>  8);
-        outb(g_bus + ATA_REG_LBA2, (sector & 0x00ff0000) >> 16);
-        outb(g_bus + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
-        if (ataWait(1))
-            return false;
+        for (uint32_t i = 0; i < count; i += IDE_DMA_SECTORS)
+        {
+            uint32_t sectors = MIN(count - i, IDE_DMA_SECTORS);
+            bool direct = mapBuffer(buf + i * ATA_SECTOR_SIZE, sectors);
+            if (!direct)
+                mapBounceBuffer(sectors);
+            if (!transferDMA(sector + i, sectors, false))
+                return false;
+            if (!direct)
+                memcpy(buf + i * ATA_SECTOR_SIZE, g_dmaBuffer, sectors * ATA_SECTOR_SIZE);
+        }
         
-        insm(g_bus, buf + i * ATA_SECTOR_SIZE, ATA_WSECTOR_SIZE);
-        ataWait(0);
-        sector++;
+        return true;
+    }
+    
+    uint32_t maxSectors = g_lba48 ? ATA_LBA48_MAX_SECTORS : ATA_LBA28_MAX_SECTORS;
+    for (uint32_t i = 0; i < count; i += maxSectors)
+    {
+        if (!readPIO(sector + i, buf + i * ATA_SECTOR_SIZE, MIN(count - i, maxSectors)))
+            return false;
     }
     
     return true;
 }
 
-bool ide_write(uint32_t sector, void *buffer, const uint32_t count)
+bool ide_write(uint64_t sector, void *buffer, const uint32_t count)
 {
-    if (!buffer)
+    if (!buffer || (!g_lba48 && sector + count > ATA_LBA28_LIMIT))
         return false;
     
     uint8_t *buf = (uint8_t *)buffer;
-    for (uint32_t i = 0; i < count; i++)
+    if (g_dmaEnabled)
     {
-        outb(g_bus + ATA_REG_CONTROL, 0x02);
-        ataWaitReady();
+        for (uint32_t i = 0; i < count; i += IDE_DMA_SECTORS)
+        {
+            uint32_t sectors = MIN(count - i, IDE_DMA_SECTORS);
+            if (!mapBuffer(buf + i * ATA_SECTOR_SIZE, sectors))
+            {
+                mapBounceBuffer(sectors);
+                memcpy(g_dmaBuffer, buf + i * ATA_SECTOR_SIZE, sectors * ATA_SECTOR_SIZE);
+            }
+            if (!transferDMA(sector + i, sectors, true))
+                return false;
+        }
         
-        outb(g_bus + ATA_REG_HDDEVSEL,  0xe0 | 0 << 4 | 
-                                    (sector & 0x0f000000) >> 24);
-        ataWait(0);
-        outb(g_bus + ATA_REG_FEATURES, 0x00);
-        outb(g_bus + ATA_REG_SECCOUNT0, 0x01);
-        outb(g_bus + ATA_REG_LBA0, (sector & 0x000000ff) >>  0);
-        outb(g_bus + ATA_REG_LBA1, (sector & 0x0000ff00) >>  8);
-        outb(g_bus + ATA_REG_LBA2, (sector & 0x00ff0000) >> 16);
-        outb(g_bus + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
-        
-        ataWait(0);
-        outsm(g_bus, buf + i * ATA_SECTOR_SIZE, ATA_WSECTOR_SIZE);
-        outb(g_bus + 0x07, ATA_CMD_CACHE_FLUSH);
-        ataWait(0);
-        sector++;
+        return true;
+    }
+    
+    uint32_t maxSectors = g_lba48 ? ATA_LBA48_MAX_SECTORS : ATA_LBA28_MAX_SECTORS;
+    for (uint32_t i = 0; i < count; i += maxSectors)
+    {
+        if (!writePIO(sector + i, buf + i * ATA_SECTOR_SIZE, MIN(count - i, maxSectors)))
+            return false;
     }
 
     return true;
+}
+
+bool ide_flush()
+{
+    issueFlush(false);
+    ataWait(0);
+    
+    return !(inb(g_bus + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF));
 }
\ No newline at end of file
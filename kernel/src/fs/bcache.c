@@ -0,0 +1,463 @@
+#include <fs/bcache.h>
+#include <dev/storage/ide.h>
+#include <dev/storage/block.h>
+#include <mem/heap.h>
+#include <mem/vmm.h>
+#include <arch/cpu.h>
+#include <sys/mutex.h>
+#include <assert.h>
+#include <libc/string.h>
+#include <logger.h>
+
+#define HASH(block)     ((block) % BCACHE_BUCKETS)
+#define READ_BATCH      8   /* Requests of a multi-block read queued before waiting for them. */
+
+static BufferHead_t *g_buckets[BCACHE_BUCKETS];
+static BufferHead_t *g_lruHead, *g_lruTail;    /* Most recently used at the head. */
+static uint32_t g_blockSize, g_sectorsPerBlock;
+static uint32_t g_bufferCount, g_maxBuffers, g_dirtyCount;
+MAKE_MUTEX(g_lock);     /* Held across disk transfers, which sleep. */
+
+static void lruRemove(BufferHead_t *bh)
+{
+    if (bh->lruPrev)
+        bh->lruPrev->lruNext = bh->lruNext;
+    else
+        g_lruHead = bh->lruNext;
+    if (bh->lruNext)
+        bh->lruNext->lruPrev = bh->lruPrev;
+    else
+        g_lruTail = bh->lruPrev;
+
+    bh->lruNext = bh->lruPrev = NULL;
+}
+
+static void lruPush(BufferHead_t *bh)
+{
+    bh->lruPrev = NULL;
+    bh->lruNext = g_lruHead;
+    if (g_lruHead)
+        g_lruHead->lruPrev = bh;
+    else
+        g_lruTail = bh;
+
+    g_lruHead = bh;
+}
+
+static void hashRemove(BufferHead_t *bh)
+{
+    BufferHead_t **link = &g_buckets[HASH(bh->block)];
+    while (*link && *link != bh)
+        link = &(*link)->hashNext;
+    if (*link)
+        *link = bh->hashNext;
+
+    bh->hashNext = NULL;
+}
+
+static void hashInsert(BufferHead_t *bh)
+{
+    bh->hashNext = g_buckets[HASH(bh->block)];
+    g_buckets[HASH(bh->block)] = bh;
+}
+
+static BufferHead_t *lookup(const uint32_t block)
+{
+    for (BufferHead_t *bh = g_buckets[HASH(block)]; bh; bh = bh->hashNext)
+    {
+        if (bh->block == block)
+            return bh;
+    }
+
+    return NULL;
+}
+
+static void submitWrite(BufferHead_t *bh)
+{
+    bh->request = (BlockRequest_t)
+    {
+        .sector = (uint64_t)bh->block * g_sectorsPerBlock,
+        .count = g_sectorsPerBlock,
+        .write = true,
+        .buffer = bh->data
+    };
+    block_submit(&bh->request);
+}
+
+static bool waitWrite(BufferHead_t *bh)
+{
+    if (!block_wait(&bh->request))
+        return false;
+
+    bh->dirty = false;
+    g_dirtyCount--;
+    return true;
+}
+
+static bool writeBack(BufferHead_t *bh)
+{
+    if (!bh->dirty)
+        return true;
+
+    submitWrite(bh);
+    return waitWrite(bh);
+}
+
+static bool flushAll()
+{
+    // Queue every write before waiting, so the block layer can sort and merge them
+    uint32_t submitted = 0;
+    for (BufferHead_t *bh = g_lruTail; bh && submitted < g_dirtyCount; bh = bh->lruPrev)
+    {
+        if (bh->dirty)
+        {
+            submitWrite(bh);
+            submitted++;
+        }
+    }
+
+    bool ret = true;
+    for (BufferHead_t *bh = g_lruTail; bh && submitted; bh = bh->lruPrev)
+    {
+        if (bh->dirty)
+        {
+            ret &= waitWrite(bh);
+            submitted--;
+        }
+    }
+
+    return ret;
+}
+
+static bool readBuffer(BufferHead_t *bh)
+{
+    bh->valid = block_read((uint64_t)bh->block * g_sectorsPerBlock, bh->data, g_sectorsPerBlock);
+    return bh->valid;
+}
+
+static void waitLoad(BufferHead_t *bh)
+{
+    if (!bh->loading)
+        return;
+
+    bh->loading = false;
+    bh->valid = block_wait(&bh->request);
+}
+
+static void submitRead(BufferHead_t *bh, const uint32_t block)
+{
+    bh->block = block;
+    bh->dirty = false;
+    bh->valid = false;
+    bh->loading = true;
+    bh->request = (BlockRequest_t)
+    {
+        .sector = (uint64_t)block * g_sectorsPerBlock,
+        .count = g_sectorsPerBlock,
+        .write = false,
+        .buffer = bh->data
+    };
+    hashInsert(bh);
+    lruPush(bh);
+    
+    // Completed by the interrupt handler, waited for only once the block is needed
+    block_submit(&bh->request);
+}
+
+static bool readDirect(const uint32_t block, const uint32_t count, uint8_t *buffer)
+{
+    // Requests are completed from interrupts, where another address space may be active.
+    // Transfer each page of the buffer through its physical address, the controller writes into the pages themselves
+    // and the block layer merges the requests back into single commands
+    PageTable_t *pml4 = (PageTable_t *)READ_CR3();
+    BlockRequest_t requests[READ_BATCH];
+    uint64_t sector = (uint64_t)block * g_sectorsPerBlock;
+    uint64_t remaining = (uint64_t)count * g_blockSize;
+    bool ret = true;
+    while (ret && remaining)
+    {
+        uint32_t submitted = 0;
+        for (; remaining && submitted < READ_BATCH; submitted++)
+        {
+            uint8_t *frame = (uint8_t *)virt2phys(pml4, buffer);
+            if (!frame)
+            {
+                ret = false;
+                break;
+            }
+            
+            uint32_t size = MIN(PAGE_SIZE - (uint64_t)buffer % PAGE_SIZE, remaining);
+            requests[submitted] = (BlockRequest_t)
+            {
+                .sector = sector,
+                .count = size / ATA_SECTOR_SIZE,
+                .write = false,
+                .buffer = frame + (uint64_t)buffer % PAGE_SIZE
+            };
+            block_submit(&requests[submitted]);
+            
+            sector += size / ATA_SECTOR_SIZE;
+            buffer += size;
+            remaining -= size;
+        }
+        
+        for (uint32_t i = 0; i < submitted; i++)
+            ret &= block_wait(&requests[i]);
+    }
+    
+    return ret;
+}
+
+static BufferHead_t *getFreeBuffer()
+{
+    // Grow the cache up to its limit
+    if (g_bufferCount < g_maxBuffers)
+    {
+        BufferHead_t *bh = (BufferHead_t *)kcalloc(sizeof(BufferHead_t));
+        if (bh && (bh->data = (uint8_t *)kmalloc(g_blockSize)))
+        {
+            g_bufferCount++;
+            return bh;
+        }
+
+        kfree(bh);
+    }
+
+    // Evict the least recently used buffer that isn't referenced
+    for (BufferHead_t *bh = g_lruTail; bh; bh = bh->lruPrev)
+    {
+        // Keep buffers the disk is still reading into
+        if (bh->refCount || (bh->loading && !bh->request.done) || !writeBack(bh))
+            continue;
+
+        lruRemove(bh);
+        hashRemove(bh);
+        return bh;
+    }
+
+    return NULL;
+}
+
+static bool readCached(const uint32_t block, const uint32_t count, uint8_t *buffer)
+{
+    BufferHead_t *batch[READ_BATCH];
+    bool ret = true;
+    for (uint32_t i = 0; ret && i < count; i += READ_BATCH)
+    {
+        // Queue the reads of a batch before waiting, the block layer merges them into single commands
+        uint32_t blocks = MIN(count - i, READ_BATCH), submitted = 0;
+        for (BufferHead_t *bh; submitted < blocks && (bh = getFreeBuffer()); submitted++)
+        {
+            bh->refCount = 1;
+            submitRead(bh, block + i + submitted);
+            batch[submitted] = bh;
+        }
+        
+        for (uint32_t j = 0; j < submitted; j++)
+        {
+            BufferHead_t *bh = batch[j];
+            waitLoad(bh);
+            bool valid = bh->valid || readBuffer(bh);
+            if (valid)
+                memcpy(buffer + (i + j) * g_blockSize, bh->data, g_blockSize);
+            
+            bh->refCount--;
+            ret &= valid;
+        }
+        
+        // Every buffer is in use, read the rest of the batch without caching it
+        if (ret && submitted < blocks)
+            ret = readDirect(block + i + submitted, blocks - submitted, buffer + (i + submitted) * g_blockSize);
+    }
+    
+    return ret;
+}
+
+void bcache_init(const uint32_t blockSize)
+{
+    g_blockSize = blockSize;
+    g_sectorsPerBlock = blockSize / ATA_SECTOR_SIZE;
+    g_maxBuffers = BCACHE_SIZE / blockSize;
+    g_bufferCount = g_dirtyCount = 0;
+    g_lruHead = g_lruTail = NULL;
+    memset(g_buckets, 0, sizeof(g_buckets));
+
+    LOG("Block cache initialized (%u buffers of %u bytes)\n", g_maxBuffers, g_blockSize);
+}
+
+BufferHead_t *bcache_get(const uint32_t block, const bool read)
+{
+    mutex_acquire(&g_lock);
+
+    BufferHead_t *bh = lookup(block);
+    if (bh)
+    {
+        bh->refCount++;
+        lruRemove(bh);
+        lruPush(bh);
+
+        // Read the block again if its read ahead failed
+        waitLoad(bh);
+        if (read && !bh->valid && !readBuffer(bh))
+        {
+            bh->refCount--;
+            mutex_release(&g_lock);
+            return NULL;
+        }
+
+        bh->valid = true;
+        mutex_release(&g_lock);
+        return bh;
+    }
+
+    if (!(bh = getFreeBuffer()))
+    {
+        mutex_release(&g_lock);
+        return NULL;
+    }
+
+    bh->block = block;
+    bh->loading = false;
+    if (read && !readBuffer(bh))
+    {
+        kfree(bh->data);
+        kfree(bh);
+        g_bufferCount--;
+
+        mutex_release(&g_lock);
+        return NULL;
+    }
+
+    bh->refCount = 1;
+    bh->dirty = false;
+    bh->valid = true;
+    hashInsert(bh);
+    lruPush(bh);
+
+    mutex_release(&g_lock);
+    return bh;
+}
+
+void bcache_prefetch(const uint32_t block)
+{
+    mutex_acquire(&g_lock);
+
+    BufferHead_t *bh;
+    if (lookup(block) || !(bh = getFreeBuffer()))
+    {
+        mutex_release(&g_lock);
+        return;
+    }
+
+    bh->refCount = 0;
+    submitRead(bh, block);
+    mutex_release(&g_lock);
+}
+
+void bcache_release(BufferHead_t *bh)
+{
+    if (!bh)
+        return;
+
+    mutex_acquire(&g_lock);
+    assert(bh->refCount > 0);
+    bh->refCount--;
+    mutex_release(&g_lock);
+}
+
+void bcache_markDirty(BufferHead_t *bh)
+{
+    mutex_acquire(&g_lock);
+    if (!bh->dirty)
+    {
+        bh->dirty = true;
+        g_dirtyCount++;
+    }
+
+    // Bound the amount of data that would be lost on a crash
+    if (g_dirtyCount >= BCACHE_DIRTY_LIMIT)
+        flushAll();
+
+    mutex_release(&g_lock);
+}
+
+bool bcache_read(const uint32_t block, void *buffer)
+{
+    BufferHead_t *bh = bcache_get(block, true);
+    if (!bh)
+        return false;
+
+    memcpy(buffer, bh->data, g_blockSize);
+    bcache_release(bh);
+    return true;
+}
+
+bool bcache_readBlocks(const uint32_t block, const uint32_t count, void *buffer, const bool direct)
+{
+    uint8_t *buf = (uint8_t *)buffer;
+    
+    // Pages of a buffer that isn't aligned to sectors don't hold whole sectors, copy through the cache
+    if ((uint64_t)buf % ATA_SECTOR_SIZE)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (!bcache_read(block + i, buf + i * g_blockSize))
+                return false;
+        }
+        
+        return true;
+    }
+    
+    mutex_acquire(&g_lock);
+    bool ret = true;
+    for (uint32_t i = 0; ret && i < count;)
+    {
+        // Cached blocks may be newer than the disk
+        BufferHead_t *bh = lookup(block + i);
+        if (bh)
+        {
+            waitLoad(bh);
+            if ((ret = bh->valid || readBuffer(bh)))
+                memcpy(buf + i * g_blockSize, bh->data, g_blockSize);
+            
+            i++;
+            continue;
+        }
+        
+        // Direct reads stream the uncached run without evicting other blocks, others keep it for the next reads
+        uint32_t end = i + 1;
+        while (end < count && !lookup(block + end))
+            end++;
+        
+        if (direct)
+            ret = readDirect(block + i, end - i, buf + i * g_blockSize);
+        else
+            ret = readCached(block + i, end - i, buf + i * g_blockSize);
+        i = end;
+    }
+    
+    mutex_release(&g_lock);
+    return ret;
+}
+
+bool bcache_write(const uint32_t block, const void *buffer)
+{
+    BufferHead_t *bh = bcache_get(block, false);
+    if (!bh)
+        return false;
+
+    memcpy(bh->data, buffer, g_blockSize);
+    bcache_markDirty(bh);
+    bcache_release(bh);
+    return true;
+}
+
+bool bcache_flush()
+{
+    mutex_acquire(&g_lock);
+    bool ret = flushAll();
+    mutex_release(&g_lock);
+
+    // Written blocks may still be in the cache of the drive
+    return block_flush() && ret;
+}
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include <fs/dcache.h>
+#include <mem/heap.h>
+#include <arch/lock.h>
+#include <libc/string.h>
+
+static Dentry_t *g_buckets[DCACHE_BUCKETS];
+static Dentry_t *g_lruHead, *g_lruTail;    /* Most recently used at the head. */
+static uint32_t g_entryCount = 0;
+MAKE_SPINLOCK(g_lock);
+
+static uint32_t hash(const uint32_t parent, const char *name)
+{
+    uint32_t h = parent * 31;
+    while (*name)
+        h = h * 31 + (uint8_t)*name++;
+
+    return h % DCACHE_BUCKETS;
+}
+
+static void lruRemove(Dentry_t *entry)
+{
+    if (entry->lruPrev)
+        entry->lruPrev->lruNext = entry->lruNext;
+    else
+        g_lruHead = entry->lruNext;
+    if (entry->lruNext)
+        entry->lruNext->lruPrev = entry->lruPrev;
+    else
+        g_lruTail = entry->lruPrev;
+
+    entry->lruNext = entry->lruPrev = NULL;
+}
+
+static void lruPush(Dentry_t *entry)
+{
+    entry->lruPrev = NULL;
+    entry->lruNext = g_lruHead;
+    if (g_lruHead)
+        g_lruHead->lruPrev = entry;
+    else
+        g_lruTail = entry;
+
+    g_lruHead = entry;
+}
+
+static void removeEntry(Dentry_t *entry)
+{
+    Dentry_t **link = &g_buckets[hash(entry->parent, entry->name)];
+    while (*link != entry)
+        link = &(*link)->hashNext;
+
+    *link = entry->hashNext;
+    lruRemove(entry);
+    kfree(entry);
+    g_entryCount--;
+}
+
+static Dentry_t *find(const uint32_t parent, const char *name)
+{
+    for (Dentry_t *entry = g_buckets[hash(parent, name)]; entry; entry = entry->hashNext)
+    {
+        if (entry->parent == parent && !strcmp(entry->name, name))
+            return entry;
+    }
+
+    return NULL;
+}
+
+bool dcache_lookup(const uint32_t parent, const char *name, uint32_t *ino)
+{
+    lock_acquire(&g_lock);
+    Dentry_t *entry = find(parent, name);
+    if (entry)
+    {
+        *ino = entry->ino;
+        lruRemove(entry);
+        lruPush(entry);
+    }
+
+    lock_release(&g_lock);
+    return entry != NULL;
+}
+
+void dcache_insert(const uint32_t parent, const char *name, const uint32_t ino)
+{
+    lock_acquire(&g_lock);
+    Dentry_t *entry = find(parent, name);
+    if (entry)
+    {
+        entry->ino = ino;
+        lock_release(&g_lock);
+        return;
+    }
+
+    if (g_entryCount >= DCACHE_SIZE)
+        removeEntry(g_lruTail);
+
+    size_t len = strlen(name);
+    if (!(entry = (Dentry_t *)kmalloc(sizeof(Dentry_t) + len + 1)))
+    {
+        lock_release(&g_lock);
+        return;
+    }
+
+    entry->parent = parent;
+    entry->ino = ino;
+    memcpy(entry->name, name, len + 1);
+
+    uint32_t bucket = hash(parent, name);
+    entry->hashNext = g_buckets[bucket];
+    g_buckets[bucket] = entry;
+    lruPush(entry);
+    g_entryCount++;
+
+    lock_release(&g_lock);
+}
+
+void dcache_invalidate(const uint32_t parent)
+{
+    lock_acquire(&g_lock);
+    Dentry_t *entry = g_lruHead;
+    while (entry)
+    {
+        Dentry_t *next = entry->lruNext;
+        if (entry->parent == parent)
+            removeEntry(entry);
+
+        entry = next;
+    }
+
+    lock_release(&g_lock);
+}
\ No newline at end of file
@@ -1,6 +1,10 @@
 #include <fs/ext2.h>
+#include <fs/bcache.h>
+#include <fs/pcache.h>
 #include <dev/storage/ide.h>
+#include <dev/storage/block.h>
 #include <mem/heap.h>
+#include <sys/mutex.h>
 #include <assert.h>
 #include <libc/string.h>
 #include <logger.h>
@@ -15,8 +19,15 @@
 
 static SuperBlock_t g_superBlock;
 static BlockGroupDescriptor_t *g_blockGroupDescriptors;
-static uint8_t *g_tmpBuf;
-static uint32_t g_blockSize, g_blockGroupDescriptorCount, g_inodesPerGroup;
+static uint32_t g_blockSize, g_blockGroupDescriptorCount, g_inodesPerGroup, g_groupBlockSpan;
+static bool g_descriptorsDirty = false;     /* Written back with the inodes instead of on every allocation. */
+static BlockReservation_t *g_reservations;  /* Preallocation windows of the cached inodes. */
+MAKE_MUTEX(g_allocLock);    /* Bitmaps are read and written through the block cache, which may sleep. */
+
+static CachedInode_t *g_inodeBuckets[EXT2_INODE_BUCKETS];
+static CachedInode_t *g_inodeLruHead, *g_inodeLruTail;     /* Most recently used at the head. */
+static uint32_t g_cachedInodes;
+MAKE_MUTEX(g_inodeLock);
 
 #define SECTORS_PER_BLOCK       (g_blockSize / ATA_SECTOR_SIZE)
 #define INODES_PER_BLOCK        (g_blockSize / g_superBlock.s_inode_size)
@@ -25,10 +36,30 @@ static uint32_t g_blockSize, g_blockGroupDescriptorCount, g_inodesPerGroup;
 #define DOUBLE_IND_PTR_BLOCKS   (SINGLE_IND_PTR_BLOCKS * PTR_BLOCKS_PER_BLOCK)
 #define TRIPLE_IND_PTR_BLOCKS   (DOUBLE_IND_PTR_BLOCKS * PTR_BLOCKS_PER_BLOCK)
 #define SECTOR2BLOCK(sector)    ((sector + 1) * ATA_SECTOR_SIZE / g_blockSize)
+#define INODE_ENTRY(inode)      ((CachedInode_t *)((uint8_t *)(inode) - __builtin_offsetof(CachedInode_t, inode)))
+#define INODE_HASH(ino)         ((ino) % EXT2_INODE_BUCKETS)
+#define BLOCK_GROUP(block)      (((block) - g_superBlock.s_first_data_block) / g_superBlock.s_blocks_per_group)
+#define BLOCK_BIT(block)        (((block) - g_superBlock.s_first_data_block) % g_superBlock.s_blocks_per_group)
+#define GROUP_FIRST_BLOCK(grp)  ((grp) * g_superBlock.s_blocks_per_group + g_superBlock.s_first_data_block)
+#define TEST_BIT(bitmap, bit)   ((bitmap)[(bit) / 8] & (1 << ((bit) % 8)))
+
+#define DX_ROOT_INFO_OFFSET     24      /* After the "." and ".." entries of the root block. */
+#define DX_NODE_ENTRIES_OFFSET  8       /* After the empty entry of an index node block. */
+#define DX_BLOCK(entry)         ((entry)->block & 0x0FFFFFFF)
+#define DX_HASH_EOF             0x7FFFFFFFU
+#define DIR_INDEX_MIN_BUCKETS   16
 
-#define b2s(block)                  ((block) * SECTORS_PER_BLOCK)
-#define readBlock(block, buffer)    (ide_read(b2s(block), buffer, SECTORS_PER_BLOCK))
-#define writeBlock(block, buffer)   (ide_write(b2s(block), buffer, SECTORS_PER_BLOCK))
+#define ROL32(x, s)             (((x) << (s)) | ((x) >> (32 - (s))))
+#define MD4_F(x, y, z)          ((z) ^ ((x) & ((y) ^ (z))))
+#define MD4_G(x, y, z)          (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define MD4_H(x, y, z)          ((x) ^ (y) ^ (z))
+#define MD4_ROUND(f, a, b, c, d, x, s)  (a += f(b, c, d) + (x), a = ROL32(a, s))
+#define MD4_K2                  013240474631U
+#define MD4_K3                  015666365641U
+#define TEA_DELTA               0x9E3779B9
+
+#define readBlock(block, buffer)    (bcache_read(block, buffer))
+#define writeBlock(block, buffer)   (bcache_write(block, buffer))
 
 #define FIND_AND_MARK_BIT(bitmap, foundLabel) ({    \
     bit = 0;                                        \
@@ -45,6 +76,12 @@ static uint32_t g_blockSize, g_blockGroupDescriptorCount, g_inodesPerGroup;
     }                                               \
 })
 
+#define SET_BIT(bitmap, bit) ({     \
+    uint32_t x = (bit) / 8;         \
+    uint32_t y = (bit) % 8;         \
+    bitmap[x] |= (1 << y);          \
+})
+
 #define CLEAR_BIT(bitmap, bit) ({   \
     uint32_t x = (bit) / 8;         \
     uint32_t y = (bit) % 8;         \
@@ -84,7 +121,7 @@ static uint8_t getFileType(const uint32_t attr)
     return ID_UNKNOWN;
 }
 
-static Inode_t *readInode(const uint32_t ino)
+static BufferHead_t *getInodeBuffer(const uint32_t ino, uint32_t *blockOffset)
 {
     uint32_t group = (ino - 1) / g_superBlock.s_inodes_per_group;
     if (group >= g_blockGroupDescriptorCount)
@@ -93,202 +130,924 @@ static Inode_t *readInode(const uint32_t ino)
     uint32_t inodeTableStart = g_blockGroupDescriptors[group].bg_inode_table;
     uint32_t inodeIndex = (ino - 1) % g_superBlock.s_inodes_per_group;
     uint32_t block = inodeTableStart + inodeIndex / INODES_PER_BLOCK;
-    if (!readBlock(block, g_tmpBuf))
-        return NULL;
     
-    Inode_t *inode = (Inode_t *)kmalloc(g_superBlock.s_inode_size);
-    if (!inode)
-        return NULL;
+    *blockOffset = (inodeIndex % INODES_PER_BLOCK) * g_superBlock.s_inode_size;
+    return bcache_get(block, true);
+}
+
+static bool writeDescriptors()
+{
+    mutex_acquire(&g_allocLock);
+    bool written = true;
+    uint8_t *buffer = (uint8_t *)g_blockGroupDescriptors;
+    for (uint32_t i = 0; g_descriptorsDirty && i < g_groupBlockSpan; i++)
+        written &= writeBlock(BLOCK_GROUP_START + i, buffer + i * g_blockSize);
+    
+    g_descriptorsDirty &= !written;
+    mutex_release(&g_allocLock);
+    return written;
+}
+
+static uint32_t groupBlocks(const uint32_t group)
+{
+    // The last group may be shorter
+    return MIN(g_superBlock.s_blocks_per_group, g_superBlock.s_blocks_count - GROUP_FIRST_BLOCK(group));
+}
+
+static bool isReserved(const uint32_t block)
+{
+    for (BlockReservation_t *window = g_reservations; window; window = window->next)
+    {
+        if (block >= window->block && block < window->block + window->count)
+            return true;
+    }
+    
+    return false;
+}
+
+static uint32_t findFreeRun(const uint8_t *bitmap, const uint32_t firstBlock, const uint32_t bits, const uint32_t goal, const uint32_t want, uint32_t *count)
+{
+    // Take the goal if it's free, otherwise the next free bit after it
+    uint32_t start = UINT32_MAX;
+    for (uint32_t i = 0; i < bits; i++)
+    {
+        uint32_t bit = (goal + i) % bits;
+        if (bit % 8 == 0 && bit + 8 <= bits && bitmap[bit / 8] == UINT8_MAX)
+        {
+            i += 7;     // Skip a full byte
+            continue;
+        }
+        if (!TEST_BIT(bitmap, bit) && !isReserved(firstBlock + bit))
+        {
+            start = bit;
+            break;
+        }
+    }
+    if (start == UINT32_MAX)
+        return UINT32_MAX;
+    
+    *count = 1;
+    while (*count < want && start + *count < bits && !TEST_BIT(bitmap, start + *count) && !isReserved(firstBlock + start + *count))
+        (*count)++;
+    
+    return start;
+}
+
+static bool markBlock(const uint32_t block)
+{
+    BlockGroupDescriptor_t *descriptor = &g_blockGroupDescriptors[BLOCK_GROUP(block)];
+    BufferHead_t *bh = bcache_get(descriptor->bg_block_bitmap, true);
+    if (!bh)
+        return false;
+    
+    // Bitmaps are modified in place in the block cache
+    SET_BIT(bh->data, BLOCK_BIT(block));
+    bcache_markDirty(bh);
+    bcache_release(bh);
+    descriptor->bg_free_blocks_count--;
+    g_descriptorsDirty = true;
+    return true;
+}
+
+static void unreserve(BlockReservation_t *window)
+{
+    BlockReservation_t **link = &g_reservations;
+    while (*link && *link != window)
+        link = &(*link)->next;
+    if (*link)
+        *link = window->next;
+    
+    window->block = window->count = 0;
+    window->next = NULL;
+}
+
+static uint32_t allocateRun(uint32_t goal, const uint32_t want, BlockReservation_t *window)
+{
+    if (goal < g_superBlock.s_first_data_block || goal >= g_superBlock.s_blocks_count)
+        goal = g_superBlock.s_first_data_block;
     
-    uint32_t blockOffset = (inodeIndex % INODES_PER_BLOCK) * g_superBlock.s_inode_size;
-    memcpy(inode, g_tmpBuf + blockOffset, g_superBlock.s_inode_size);
+    // Search the group of the goal first, then the following ones
+    mutex_acquire(&g_allocLock);
+    uint32_t first = BLOCK_GROUP(goal);
+    for (uint32_t i = 0; i < g_blockGroupDescriptorCount; i++)
+    {
+        uint32_t group = (first + i) % g_blockGroupDescriptorCount;
+        BlockGroupDescriptor_t *descriptor = &g_blockGroupDescriptors[group];
+        if (!descriptor->bg_free_blocks_count)
+            continue;
         
-    return inode;
+        BufferHead_t *bh = bcache_get(descriptor->bg_block_bitmap, true);
+        if (!bh)
+            break;
+        
+        uint32_t count;
+        uint32_t bit = findFreeRun(bh->data, GROUP_FIRST_BLOCK(group), groupBlocks(group), group == first ? BLOCK_BIT(goal) : 0, MIN(want, descriptor->bg_free_blocks_count), &count);
+        bcache_release(bh);
+        if (bit == UINT32_MAX)
+            continue;
+        
+        // Only the first block is allocated on the disk, the rest of the run is kept free in memory
+        uint32_t block = GROUP_FIRST_BLOCK(group) + bit;
+        if (!markBlock(block))
+            break;
+        if (window && count > 1)
+        {
+            window->block = block + 1;
+            window->count = count - 1;
+            window->next = g_reservations;
+            g_reservations = window;
+        }
+        
+        mutex_release(&g_allocLock);
+        return block;
+    }
+    
+    mutex_release(&g_allocLock);
+    return 0;
 }
 
-static bool writeInode(const uint32_t ino, Inode_t *inode)
+static uint32_t allocateReserved(BlockReservation_t *window)
 {
-    uint32_t group = (ino - 1) / g_superBlock.s_inodes_per_group;
-    if (group >= g_blockGroupDescriptorCount)
+    mutex_acquire(&g_allocLock);
+    uint32_t block = window->block;
+    if (!markBlock(block))
+    {
+        mutex_release(&g_allocLock);
+        return 0;
+    }
+    
+    window->block++;
+    if (!--window->count)
+        unreserve(window);
+    
+    mutex_release(&g_allocLock);
+    return block;
+}
+
+static int freeBlocks(uint32_t block, uint32_t count)
+{
+    if (!block)
+        return EIO;
+    if (block < g_superBlock.s_first_data_block || BLOCK_GROUP(block) >= g_blockGroupDescriptorCount)
+        return EPERM;
+    
+    mutex_acquire(&g_allocLock);
+    while (count)
+    {
+        // A run may continue in the next group
+        uint32_t group = BLOCK_GROUP(block), bit = BLOCK_BIT(block);
+        if (group >= g_blockGroupDescriptorCount)
+            break;
+        
+        BlockGroupDescriptor_t *descriptor = &g_blockGroupDescriptors[group];
+        BufferHead_t *bh = bcache_get(descriptor->bg_block_bitmap, true);
+        if (!bh)
+        {
+            mutex_release(&g_allocLock);
+            return EIO;
+        }
+        
+        uint32_t blocks = MIN(count, groupBlocks(group) - bit);
+        for (uint32_t j = 0; j < blocks; j++)
+            CLEAR_BIT(bh->data, bit + j);
+        
+        bcache_markDirty(bh);
+        bcache_release(bh);
+        descriptor->bg_free_blocks_count += blocks;
+        g_descriptorsDirty = true;
+        
+        block += blocks;
+        count -= blocks;
+    }
+    
+    mutex_release(&g_allocLock);
+    return ENOER;
+}
+
+static void discardPrealloc(Inode_t *inode)
+{
+    // Reserved blocks were never marked on the disk, nothing is left behind after a crash
+    CachedInode_t *cached = INODE_ENTRY(inode);
+    if (!cached->prealloc.count)
+        return;
+    
+    mutex_acquire(&g_allocLock);
+    unreserve(&cached->prealloc);
+    mutex_release(&g_allocLock);
+}
+
+static bool writeBackInode(CachedInode_t *entry)
+{
+    if (!entry->dirty)
+        return true;
+    
+    uint32_t blockOffset;
+    BufferHead_t *bh = getInodeBuffer(entry->ino, &blockOffset);
+    if (!bh)
+        return false;
+    
+    memcpy(bh->data + blockOffset, &entry->inode, g_superBlock.s_inode_size);
+    bcache_markDirty(bh);
+    bcache_release(bh);
+    
+    entry->dirty = false;
+    return true;
+}
+
+static void unlinkCachedInode(CachedInode_t *entry)
+{
+    if (entry->lruPrev)
+        entry->lruPrev->lruNext = entry->lruNext;
+    else
+        g_inodeLruHead = entry->lruNext;
+    if (entry->lruNext)
+        entry->lruNext->lruPrev = entry->lruPrev;
+    else
+        g_inodeLruTail = entry->lruPrev;
+    
+    entry->lruNext = entry->lruPrev = NULL;
+}
+
+static void linkCachedInode(CachedInode_t *entry)
+{
+    entry->lruPrev = NULL;
+    entry->lruNext = g_inodeLruHead;
+    if (g_inodeLruHead)
+        g_inodeLruHead->lruPrev = entry;
+    else
+        g_inodeLruTail = entry;
+    
+    g_inodeLruHead = entry;
+}
+
+static void freeDirIndex(DirIndex_t *index)
+{
+    if (!index)
+        return;
+    
+    for (uint32_t i = 0; i < index->count; i++)
+        kfree(index->entries[i]);
+    
+    kfree(index->entries);
+    kfree(index->buckets);
+    kfree(index);
+}
+
+static void evictInodes()
+{
+    // Drop the least recently used inodes that aren't referenced
+    CachedInode_t *entry = g_inodeLruTail;
+    while (entry && g_cachedInodes >= EXT2_INODE_CACHE_SIZE)
+    {
+        CachedInode_t *prev = entry->lruPrev;
+        if (!entry->refCount && writeBackInode(entry))
+        {
+            CachedInode_t **link = &g_inodeBuckets[INODE_HASH(entry->ino)];
+            while (*link != entry)
+                link = &(*link)->hashNext;
+            
+            *link = entry->hashNext;
+            unlinkCachedInode(entry);
+            discardPrealloc(&entry->inode);
+            freeDirIndex(entry->dirIndex);
+            kfree(entry);
+            g_cachedInodes--;
+        }
+        
+        entry = prev;
+    }
+}
+
+static Inode_t *getInode(const uint32_t ino)
+{
+    mutex_acquire(&g_inodeLock);
+    
+    CachedInode_t *entry = g_inodeBuckets[INODE_HASH(ino)];
+    while (entry && entry->ino != ino)
+        entry = entry->hashNext;
+    
+    if (entry)
+    {
+        entry->refCount++;
+        unlinkCachedInode(entry);
+        linkCachedInode(entry);
+        
+        mutex_release(&g_inodeLock);
+        return &entry->inode;
+    }
+    
+    // Read the inode from its table block
+    uint32_t blockOffset;
+    BufferHead_t *bh = getInodeBuffer(ino, &blockOffset);
+    if (!bh)
+    {
+        mutex_release(&g_inodeLock);
         return NULL;
+    }
     
-    uint32_t inodeTableStart = g_blockGroupDescriptors[group].bg_inode_table;
-    uint32_t inodeIndex = (ino - 1) % g_superBlock.s_inodes_per_group;
-    uint32_t block = inodeTableStart + inodeIndex / INODES_PER_BLOCK;
-    if (!readBlock(block, g_tmpBuf))
+    evictInodes();
+    entry = (CachedInode_t *)kmalloc(__builtin_offsetof(CachedInode_t, inode) + MAX(g_superBlock.s_inode_size, sizeof(Inode_t)));
+    if (!entry)
+    {
+        bcache_release(bh);
+        mutex_release(&g_inodeLock);
         return NULL;
+    }
+    
+    memcpy(&entry->inode, bh->data + blockOffset, g_superBlock.s_inode_size);
+    bcache_release(bh);
+    
+    entry->ino = ino;
+    entry->refCount = 1;
+    entry->dirty = false;
+    entry->dirIndex = NULL;
+    entry->extentCount = entry->extentHand = 0;
+    entry->prealloc = (BlockReservation_t){ 0 };
+    entry->hashNext = g_inodeBuckets[INODE_HASH(ino)];
+    g_inodeBuckets[INODE_HASH(ino)] = entry;
+    linkCachedInode(entry);
+    g_cachedInodes++;
+    
+    mutex_release(&g_inodeLock);
+    return &entry->inode;
+}
+
+static void putInode(Inode_t *inode)
+{
+    if (!inode)
+        return;
     
-    uint32_t blockOffset = (inodeIndex % INODES_PER_BLOCK) * g_superBlock.s_inode_size;
-    memcpy(g_tmpBuf + blockOffset, inode, g_superBlock.s_inode_size);
+    CachedInode_t *entry = INODE_ENTRY(inode);
+    mutex_acquire(&g_inodeLock);
+    assert(entry->refCount > 0);
+    if (--entry->refCount == 0)
+    {
+        writeBackInode(entry);
+        writeDescriptors();
+    }
     
-    return writeBlock(block, g_tmpBuf);
+    mutex_release(&g_inodeLock);
 }
 
-static uint32_t getRealBlock(Inode_t *inode, const uint32_t block)
-{    
+static bool writeInode(const uint32_t ino, Inode_t *inode)
+{
+    CachedInode_t *entry = INODE_ENTRY(inode);
+    assert(entry->ino == ino);
+    
+    // Written back when the last reference is put or on sync
+    entry->dirty = true;
+    return true;
+}
+
+static uint32_t *getBlockSlot(Inode_t *inode, uint32_t block, BufferHead_t **bh)
+{
+    *bh = NULL;
     if (block < EXT2_NDIR_BLOCKS)   // Direct
-        return inode->i_block[block];
-    else if (block < EXT2_IND_BLOCK + SINGLE_IND_PTR_BLOCKS)   // Single indirect
+        return &inode->i_block[block];
+    
+    // Find the indirection level of the block
+    block -= EXT2_NDIR_BLOCKS;
+    uint32_t level = 0;
+    uint64_t span = PTR_BLOCKS_PER_BLOCK;
+    while (level < 3 && block >= span)
     {
-        // Read single indirect block
-        if (!readBlock(inode->i_block[EXT2_IND_BLOCK], g_tmpBuf))
-            return 0;
+        block -= span;
+        span *= PTR_BLOCKS_PER_BLOCK;
+        level++;
+    }
+    if (level == 3)
+        return NULL;
+    
+    // Walk down the indirect blocks
+    uint32_t next = inode->i_block[EXT2_IND_BLOCK + level];
+    while (next)
+    {
+        BufferHead_t *current = bcache_get(next, true);
+        if (!current)
+            return NULL;
         
-        return ((uint32_t *)g_tmpBuf)[block - EXT2_IND_BLOCK];
+        span /= PTR_BLOCKS_PER_BLOCK;
+        uint32_t *slot = &((uint32_t *)current->data)[block / span];
+        if (span == 1)
+        {
+            *bh = current;
+            return slot;
+        }
+        
+        block %= span;
+        next = *slot;
+        bcache_release(current);
+    }
+    
+    return NULL;
+}
+
+static BlockExtent_t *findExtent(CachedInode_t *cached, const uint32_t block)
+{
+    for (uint32_t i = 0; i < cached->extentCount; i++)
+    {
+        BlockExtent_t *extent = &cached->extents[i];
+        if (block >= extent->block && block - extent->block < extent->count)
+            return extent;
     }
-    else if (block < EXT2_IND_BLOCK + DOUBLE_IND_PTR_BLOCKS + SINGLE_IND_PTR_BLOCKS)    // Double indirect
+    
+    return NULL;
+}
+
+static bool growExtent(CachedInode_t *cached, const uint32_t block, const uint32_t real, const uint32_t count)
+{
+    // Continue a run ending right before the new one, runs may span indirect blocks
+    for (uint32_t i = 0; i < cached->extentCount; i++)
     {
-        // Read double indirect block
-        if (!readBlock(inode->i_block[EXT2_DIND_BLOCK], g_tmpBuf))
-            return 0;
+        BlockExtent_t *extent = &cached->extents[i];
+        if (extent->block + extent->count == block && extent->real + extent->count == real)
+        {
+            extent->count += count;
+            return true;
+        }
+    }
+    
+    return false;
+}
 
-        uint32_t b = (block - EXT2_DIND_BLOCK) / PTR_BLOCKS_PER_BLOCK;
-        uint32_t c = b / PTR_BLOCKS_PER_BLOCK;
-        uint32_t d = b - c * PTR_BLOCKS_PER_BLOCK;
-        
-        // Read single indirect block
-        uint32_t singleIndirectBlock = ((uint32_t *)g_tmpBuf)[c];
-        if (!readBlock(singleIndirectBlock, g_tmpBuf))
-            return 0;
+static void addExtent(CachedInode_t *cached, const uint32_t block, const uint32_t real, const uint32_t count)
+{
+    if (growExtent(cached, block, real, count))
+        return;
+    
+    BlockExtent_t *extent;
+    if (cached->extentCount < EXT2_EXTENT_CACHE_SIZE)
+        extent = &cached->extents[cached->extentCount++];
+    else
+    {
+        extent = &cached->extents[cached->extentHand];
+        cached->extentHand = (cached->extentHand + 1) % EXT2_EXTENT_CACHE_SIZE;
+    }
+    
+    *extent = (BlockExtent_t){ .block = block, .real = real, .count = count };
+}
+
+static void dropExtents(Inode_t *inode)
+{
+    CachedInode_t *cached = INODE_ENTRY(inode);
+    cached->extentCount = cached->extentHand = 0;
+}
+
+static uint32_t mapBlock(Inode_t *inode, const uint32_t block, uint32_t *count)
+{
+    CachedInode_t *cached = INODE_ENTRY(inode);
+    BlockExtent_t *extent = findExtent(cached, block);
+    if (extent)
+    {
+        if (count)
+            *count = extent->count - (block - extent->block);
         
-        return ((uint32_t *)g_tmpBuf)[d];
+        return extent->real + (block - extent->block);
     }
-    else if (block < EXT2_IND_BLOCK + TRIPLE_IND_PTR_BLOCKS + DOUBLE_IND_PTR_BLOCKS + SINGLE_IND_PTR_BLOCKS)  // Triple indirect
+    
+    BufferHead_t *bh;
+    uint32_t *slot = getBlockSlot(inode, block, &bh);
+    uint32_t real = slot ? *slot : 0, run = 1;
+    if (real)
     {
-        // Read triple indirect block
-        if (!readBlock(inode->i_block[EXT2_TIND_BLOCK], g_tmpBuf))
-            return 0;
+        // Record the run of contiguous blocks following the slot in the same block of pointers
+        uint32_t slots = bh ? PTR_BLOCKS_PER_BLOCK - (slot - (uint32_t *)bh->data) : EXT2_NDIR_BLOCKS - block;
+        while (run < slots && slot[run] == real + run)
+            run++;
         
-        uint32_t b = block - EXT2_TIND_BLOCK - PTR_BLOCKS_PER_BLOCK;
-        uint32_t c = b - PTR_BLOCKS_PER_BLOCK * PTR_BLOCKS_PER_BLOCK;
-        uint32_t d = c / (PTR_BLOCKS_PER_BLOCK * PTR_BLOCKS_PER_BLOCK);
-        uint32_t e = c - d * PTR_BLOCKS_PER_BLOCK * PTR_BLOCKS_PER_BLOCK;
-        uint32_t f = e / PTR_BLOCKS_PER_BLOCK;
-        uint32_t g = e - f * PTR_BLOCKS_PER_BLOCK;
-
-        // Read double indirect block
-        uint32_t doubleIndirectBlock = ((uint32_t *)g_tmpBuf)[d];
-        if (!readBlock(doubleIndirectBlock, g_tmpBuf))
-            return 0;
+        addExtent(cached, block, real, run);
+    }
+    
+    bcache_release(bh);
+    if (count)
+        *count = run;
+    
+    return real;
+}
 
-        // Read single indirect block
-        uint32_t singleIndirectBlock = ((uint32_t *)g_tmpBuf)[f];
-        if (!readBlock(singleIndirectBlock, g_tmpBuf))
-            return 0;
+static uint32_t getRealBlock(Inode_t *inode, const uint32_t block)
+{
+    return mapBlock(inode, block, NULL);
+}
+
+static bool setRealBlock(Inode_t *inode, const uint32_t block, const uint32_t real)
+{
+    BufferHead_t *bh;
+    uint32_t *slot = getBlockSlot(inode, block, &bh);
+    if (!slot)
+        return false;
+    
+    *slot = real;
+    if (bh)
+    {
+        bcache_markDirty(bh);
+        bcache_release(bh);
+    }
+    
+    // Forget the old mapping, an appended block may extend an existing run
+    CachedInode_t *cached = INODE_ENTRY(inode);
+    if (findExtent(cached, block))
+        dropExtents(inode);
+    else if (real)
+        growExtent(cached, block, real, 1);
+    
+    return true;
+}
+
+static uint32_t dxHackHash(const char *name, const int len, const bool unsignedChars)
+{
+    uint32_t hash, hash0 = 0x12A3FE2D, hash1 = 0x37ABE8F9;
+    for (int i = 0; i < len; i++)
+    {
+        int c = unsignedChars ? (int)(uint8_t)name[i] : (int)(int8_t)name[i];
+        hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+        if (hash & 0x80000000)
+            hash -= 0x7FFFFFFF;
         
-        return ((uint32_t *)g_tmpBuf)[g];
+        hash1 = hash0;
+        hash0 = hash;
     }
     
-    return 0;
+    return hash0 << 1;
 }
 
-static bool setRealBlock(Inode_t *inode, const uint32_t block, const uint32_t real)
+static void str2HashBuf(const char *msg, int len, uint32_t *buf, int num, const bool unsignedChars)
 {
-    if (block < EXT2_NDIR_BLOCKS)   // Direct
+    uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+    
+    uint32_t val = pad;
+    if (len > num * 4)
+        len = num * 4;
+    for (int i = 0; i < len; i++)
     {
-        inode->i_block[block] = real;
-        return true;
+        int c = unsignedChars ? (int)(uint8_t)msg[i] : (int)(int8_t)msg[i];
+        val = c + (val << 8);
+        if (i % 4 == 3)
+        {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
     }
-    else if (block < EXT2_IND_BLOCK + SINGLE_IND_PTR_BLOCKS)   // Single indirect
+    
+    if (--num >= 0)
+        *buf++ = val;
+    while (--num >= 0)
+        *buf++ = pad;
+}
+
+static void halfMd4Transform(uint32_t buf[4], const uint32_t in[8])
+{
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+    
+    MD4_ROUND(MD4_F, a, b, c, d, in[0], 3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[1], 7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[2], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[3], 19);
+    MD4_ROUND(MD4_F, a, b, c, d, in[4], 3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[5], 7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[6], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[7], 19);
+    
+    MD4_ROUND(MD4_G, a, b, c, d, in[1] + MD4_K2, 3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[3] + MD4_K2, 5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[5] + MD4_K2, 9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[7] + MD4_K2, 13);
+    MD4_ROUND(MD4_G, a, b, c, d, in[0] + MD4_K2, 3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[2] + MD4_K2, 5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[4] + MD4_K2, 9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[6] + MD4_K2, 13);
+    
+    MD4_ROUND(MD4_H, a, b, c, d, in[3] + MD4_K3, 3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[7] + MD4_K3, 9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[2] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[6] + MD4_K3, 15);
+    MD4_ROUND(MD4_H, a, b, c, d, in[1] + MD4_K3, 3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[5] + MD4_K3, 9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[0] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[4] + MD4_K3, 15);
+    
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+static void teaTransform(uint32_t buf[4], const uint32_t in[4])
+{
+    uint32_t sum = 0, b0 = buf[0], b1 = buf[1];
+    for (int n = 0; n < 16; n++)
     {
-        // Read single indirect block
-        if (!readBlock(inode->i_block[EXT2_IND_BLOCK], g_tmpBuf))
-            return false;
+        sum += TEA_DELTA;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+    
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+static uint32_t dirHash(const char *name, int len, uint8_t version)
+{
+    uint32_t buf[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 }, in[8], hash;
+    for (int i = 0; i < 4; i++)
+    {
+        if (g_superBlock.s_hash_seed[i])
+        {
+            memcpy(buf, g_superBlock.s_hash_seed, sizeof(buf));
+            break;
+        }
+    }
+    
+    bool unsignedChars = version >= DX_HASH_UNSIGNED_DELTA;
+    if (unsignedChars)
+        version -= DX_HASH_UNSIGNED_DELTA;
+    
+    switch (version)
+    {
+        case DX_HASH_LEGACY:
+            hash = dxHackHash(name, len, unsignedChars);
+            break;
+        case DX_HASH_HALF_MD4:
+            for (; len > 0; len -= 32, name += 32)
+            {
+                str2HashBuf(name, len, in, 8, unsignedChars);
+                halfMd4Transform(buf, in);
+            }
+            hash = buf[1];
+            break;
+        case DX_HASH_TEA:
+            for (; len > 0; len -= 16, name += 16)
+            {
+                str2HashBuf(name, len, in, 4, unsignedChars);
+                teaTransform(buf, in);
+            }
+            hash = buf[0];
+            break;
+        default:
+            return 0;
+    }
+    
+    hash &= ~1;
+    if (hash == (DX_HASH_EOF << 1))
+        hash = (DX_HASH_EOF - 1) << 1;
+    
+    return hash;
+}
+
+static uint32_t scanDirBlock(Inode_t *inode, const uint32_t block, const char *name)
+{
+    BufferHead_t *bh = bcache_get(getRealBlock(inode, block), true);
+    if (!bh)
+        return 0;
+    
+    size_t len = strlen(name);
+    uint32_t ino = 0;
+    for (uint32_t offset = 0; offset + sizeof(Directory_t) <= g_blockSize;)
+    {
+        Directory_t *dir = (Directory_t *)(bh->data + offset);
+        if (dir->rec_len < sizeof(Directory_t))
+            break;
+        if (dir->inode && dir->name_len == len && !memcmp(dir->name, name, len))
+        {
+            ino = dir->inode;
+            break;
+        }
         
-        ((uint32_t *)g_tmpBuf)[block - EXT2_IND_BLOCK] = real;
-        return true;
+        offset += dir->rec_len;
+    }
+    
+    bcache_release(bh);
+    return ino;
+}
+
+static bool dxLookup(Inode_t *inode, const char *name, uint32_t *ino)
+{
+    BufferHead_t *bh = bcache_get(getRealBlock(inode, 0), true);
+    if (!bh)
+        return false;
+    
+    // Verify the root of the tree
+    DxRootInfo_t *info = (DxRootInfo_t *)(bh->data + DX_ROOT_INFO_OFFSET);
+    if (info->reserved_zero || info->info_length != sizeof(DxRootInfo_t) || info->indirect_levels >= DX_MAX_LEVELS)
+    {
+        bcache_release(bh);
+        return false;
     }
-    else if (block < EXT2_IND_BLOCK + DOUBLE_IND_PTR_BLOCKS + SINGLE_IND_PTR_BLOCKS)    // Double indirect
+    
+    uint8_t version = info->hash_version;
+    if (version <= DX_HASH_TEA && (g_superBlock.s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+        version += DX_HASH_UNSIGNED_DELTA;
+    
+    uint32_t hash = dirHash(name, strlen(name), version);
+    DxEntry_t *entries = (DxEntry_t *)((uint8_t *)info + info->info_length);
+    uint32_t levels = info->indirect_levels, leaf = 0, nextLeaf = 0;
+    bool collision = false;
+    while (true)
     {
-        // Read double indirect block
-        if (!readBlock(inode->i_block[EXT2_DIND_BLOCK], g_tmpBuf))
+        DxCountLimit_t *countLimit = (DxCountLimit_t *)entries;
+        if (!countLimit->count || countLimit->count > countLimit->limit)
+        {
+            bcache_release(bh);
             return false;
+        }
+        
+        // Find the last entry with a hash not above the name's, the first entry has no hash
+        uint32_t low = 1, high = countLimit->count;
+        while (low < high)
+        {
+            uint32_t mid = (low + high) / 2;
+            if (entries[mid].hash <= hash)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        
+        leaf = DX_BLOCK(&entries[low - 1]);
         
-        uint32_t b = (block - EXT2_DIND_BLOCK) / PTR_BLOCKS_PER_BLOCK;
-        uint32_t c = b / PTR_BLOCKS_PER_BLOCK;
-        uint32_t d = b - c * PTR_BLOCKS_PER_BLOCK;
+        // The name may continue in the next block if the hashes collide
+        collision = low < countLimit->count && (entries[low].hash & 1) && (entries[low].hash & ~1) == hash;
+        if (collision)
+            nextLeaf = DX_BLOCK(&entries[low]);
+        if (levels-- == 0)
+            break;
         
-        // Read single indirect block
-        uint32_t singleIndirectBlock = ((uint32_t *)g_tmpBuf)[c];
-        if (!readBlock(singleIndirectBlock, g_tmpBuf))
+        bcache_release(bh);
+        if (!(bh = bcache_get(getRealBlock(inode, leaf), true)))
             return false;
         
-        ((uint32_t *)g_tmpBuf)[d] = real;
-        return true;
+        entries = (DxEntry_t *)(bh->data + DX_NODE_ENTRIES_OFFSET);
     }
-    else if (block < EXT2_IND_BLOCK + TRIPLE_IND_PTR_BLOCKS + DOUBLE_IND_PTR_BLOCKS + SINGLE_IND_PTR_BLOCKS)  // Triple indirect
+    
+    bcache_release(bh);
+    *ino = scanDirBlock(inode, leaf, name);
+    if (!*ino && collision)
+        *ino = scanDirBlock(inode, nextLeaf, name);
+    
+    return true;
+}
+
+static uint32_t nameHash(const char *name, const size_t len)
+{
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)name[i]) * 16777619U;
+    
+    return hash;
+}
+
+static bool addIndexEntry(DirIndex_t *index, Directory_t *dir)
+{
+    if (index->count == index->capacity)
     {
-        // Read triple indirect block
-        if (!readBlock(inode->i_block[EXT2_TIND_BLOCK], g_tmpBuf))
+        uint32_t capacity = index->capacity ? index->capacity * 2 : DIR_INDEX_MIN_BUCKETS;
+        DirIndexEntry_t **entries = (DirIndexEntry_t **)kmalloc(capacity * sizeof(DirIndexEntry_t *));
+        if (!entries)
             return false;
         
-        uint32_t b = block - EXT2_TIND_BLOCK - PTR_BLOCKS_PER_BLOCK;
-        uint32_t c = b - PTR_BLOCKS_PER_BLOCK * PTR_BLOCKS_PER_BLOCK;
-        uint32_t d = c / (PTR_BLOCKS_PER_BLOCK * PTR_BLOCKS_PER_BLOCK);
-        uint32_t e = c - d * PTR_BLOCKS_PER_BLOCK * PTR_BLOCKS_PER_BLOCK;
-        uint32_t f = e / PTR_BLOCKS_PER_BLOCK;
-        uint32_t g = e - f * PTR_BLOCKS_PER_BLOCK;
-
-        // Read double indirect block
-        uint32_t doubleIndirectBlock = ((uint32_t *)g_tmpBuf)[d];
-        if (!readBlock(doubleIndirectBlock, g_tmpBuf))
-            return false;
-
-        // Read single indirect block
-        uint32_t singleIndirectBlock = ((uint32_t *)g_tmpBuf)[f];
-        if (!readBlock(singleIndirectBlock, g_tmpBuf))
-            return false;
+        if (index->entries)
+            memcpy(entries, index->entries, index->count * sizeof(DirIndexEntry_t *));
         
-        ((uint32_t *)g_tmpBuf)[g] = real;
-        return true;
+        kfree(index->entries);
+        index->entries = entries;
+        index->capacity = capacity;
     }
     
-    return false;
+    DirIndexEntry_t *entry = (DirIndexEntry_t *)kmalloc(sizeof(DirIndexEntry_t) + dir->name_len + 1);
+    if (!entry)
+        return false;
+    
+    entry->ino = dir->inode;
+    entry->hashNext = NULL;
+    memcpy(entry->name, dir->name, dir->name_len);
+    entry->name[dir->name_len] = '\0';
+    
+    index->entries[index->count++] = entry;
+    return true;
 }
 
-static bool allocateBlock(Inode_t *inode, const uint32_t ino, uint32_t block)
+static DirIndex_t *getDirIndex(Inode_t *inode)
 {
-    uint8_t *blockBitmap = (uint8_t *)kmalloc(g_blockSize);
-    if (!blockBitmap)
-        return false;
+    CachedInode_t *cached = INODE_ENTRY(inode);
+    if (cached->dirIndex)
+        return cached->dirIndex;
     
-    uint32_t bit = 0, newBlock = 0;
-    for (uint32_t i = 0; i < g_blockGroupDescriptorCount; i++)
+    DirIndex_t *index = (DirIndex_t *)kcalloc(sizeof(DirIndex_t));
+    if (!index)
+        return NULL;
+    
+    // Collect the entries of every block in order
+    for (uint32_t block = 0; block < inode->i_size / g_blockSize; block++)
     {
-        if (g_blockGroupDescriptors[i].bg_free_blocks_count > 0)
+        BufferHead_t *bh = bcache_get(getRealBlock(inode, block), true);
+        if (!bh)
+            goto fail;
+        
+        for (uint32_t offset = 0; offset + sizeof(Directory_t) <= g_blockSize;)
         {
-            if (!readBlock(g_blockGroupDescriptors[i].bg_block_bitmap, blockBitmap))
+            Directory_t *dir = (Directory_t *)(bh->data + offset);
+            if (dir->rec_len < sizeof(Directory_t))
+                break;
+            if (dir->inode && !addIndexEntry(index, dir))
             {
-                kfree(blockBitmap);   
-                return NULL;
+                bcache_release(bh);
+                goto fail;
             }
             
-            FIND_AND_MARK_BIT(blockBitmap, found_bit);    // Jump if found a bit
-            continue;   // Continue to the next group descriptor
-        }
-          
-found_bit:
-        if (!bit)
-        {
-            kfree(blockBitmap);
-            return NULL;
+            offset += dir->rec_len;
         }
         
-        newBlock = bit + g_superBlock.s_blocks_per_group * i + 1;        
-        g_blockGroupDescriptors[i].bg_free_blocks_count--;
-        writeBlock(g_blockGroupDescriptors[i].bg_block_bitmap, blockBitmap);
-        writeBlock(BLOCK_GROUP_START, g_blockGroupDescriptors);
-        
-        break;
+        bcache_release(bh);
+    }
+    
+    // Hash the names
+    index->bucketCount = DIR_INDEX_MIN_BUCKETS;
+    while (index->bucketCount < index->count)
+        index->bucketCount <<= 1;
+    
+    if (!(index->buckets = (DirIndexEntry_t **)kcalloc(index->bucketCount * sizeof(DirIndexEntry_t *))))
+        goto fail;
+    
+    for (uint32_t i = 0; i < index->count; i++)
+    {
+        DirIndexEntry_t *entry = index->entries[i];
+        uint32_t bucket = nameHash(entry->name, strlen(entry->name)) & (index->bucketCount - 1);
+        entry->hashNext = index->buckets[bucket];
+        index->buckets[bucket] = entry;
+    }
+    
+    cached->dirIndex = index;
+    return index;
+
+fail:
+    freeDirIndex(index);
+    return NULL;
+}
+
+static uint32_t findEntry(Inode_t *inode, const char *name)
+{
+    // Indexed directories can be searched without building the in-memory index
+    uint32_t ino;
+    if (!INODE_ENTRY(inode)->dirIndex && (inode->i_flags & EXT2_INDEX_FL) && dxLookup(inode, name, &ino))
+        return ino;
+    
+    DirIndex_t *index = getDirIndex(inode);
+    if (!index)
+        return 0;
+    
+    size_t len = strlen(name);
+    DirIndexEntry_t *entry = index->buckets[nameHash(name, len) & (index->bucketCount - 1)];
+    for (; entry; entry = entry->hashNext)
+    {
+        if (!strcmp(entry->name, name))
+            return entry->ino;
+    }
+    
+    return 0;
+}
+
+static void invalidateDirIndex(Inode_t *inode, const uint32_t ino)
+{
+    CachedInode_t *cached = INODE_ENTRY(inode);
+    freeDirIndex(cached->dirIndex);
+    cached->dirIndex = NULL;
+    
+    // The htree isn't maintained on changes, fall back to linear directories
+    if (inode->i_flags & EXT2_INDEX_FL)
+    {
+        inode->i_flags &= ~EXT2_INDEX_FL;
+        writeInode(ino, inode);
     }
+}
 
-    kfree(blockBitmap);
+static bool allocateBlock(Inode_t *inode, const uint32_t ino, uint32_t block)
+{
+    // Place the block right after the previous one of the file, or in the group of the inode
+    CachedInode_t *cached = INODE_ENTRY(inode);
+    uint32_t previous = block ? getRealBlock(inode, block - 1) : 0;
+    uint32_t goal = previous ? previous + 1 : GROUP_FIRST_BLOCK((ino - 1) / g_superBlock.s_inodes_per_group);
+    
+    // The preallocation window is only used if the file continues into it
+    if (cached->prealloc.count && cached->prealloc.block != goal)
+        discardPrealloc(inode);
+    
+    uint32_t newBlock;
+    if (cached->prealloc.count)
+        newBlock = allocateReserved(&cached->prealloc);
+    else if (INODE_FILE(inode))
+        newBlock = allocateRun(goal, EXT2_PREALLOC_BLOCKS, &cached->prealloc);
+    else
+        newBlock = allocateRun(goal, 1, NULL);
     if (!newBlock)
         return false;
     
     // Write block
     if (!setRealBlock(inode, block, newBlock))
+    {
+        freeBlocks(newBlock, 1);
         return false;
+    }
     
     inode->i_sectors += SECTORS_PER_BLOCK;  // Update sector count
     inode->i_size += g_blockSize;   // Update size
@@ -302,6 +1061,36 @@ static bool readInodeBlock(Inode_t *inode, const uint32_t block, void *buffer)
     return readBlock(getRealBlock(inode, block), buffer);
 }
 
+static void readAhead(VfsNode_t *node, Inode_t *inode, const uint32_t offset, const uint32_t end)
+{
+    // A read not continuing the previous one is random, stop reading ahead
+    if (offset != node->raOffset)
+    {
+        node->raEnd = node->raWindow = 0;
+        node->raOffset = end;
+        return;
+    }
+    
+    node->raOffset = end;
+    uint32_t next = (end + g_blockSize - 1) / g_blockSize;
+    
+    // Refill once the reader is halfway through the window, so the disk stays ahead of it
+    if (node->raEnd > next + node->raWindow / 2)
+        return;
+    
+    node->raWindow = node->raWindow ? MIN(node->raWindow * 2, EXT2_READAHEAD_MAX) : EXT2_READAHEAD_MIN;
+    uint32_t fileBlocks = (inode->i_size + g_blockSize - 1) / g_blockSize;
+    uint32_t last = MIN(next + node->raWindow, fileBlocks);
+    for (uint32_t block = MAX(next, node->raEnd); block < last; block++)
+    {
+        uint32_t real = getRealBlock(inode, block);
+        if (real)
+            bcache_prefetch(real);
+    }
+    
+    node->raEnd = MAX(node->raEnd, last);
+}
+
 static bool writeInodeBlock(Inode_t *inode, const uint32_t ino, const uint32_t block, void *buffer)
 {
     while (block >= SECTOR2BLOCK(inode->i_sectors))    // Allocate blocks
@@ -315,6 +1104,7 @@ static bool writeInodeBlock(Inode_t *inode, const uint32_t ino, const uint32_t b
 
 static bool insertInodeInDir(Inode_t *parentInode, uint32_t pino, const uint32_t newIno, const char *name, const uint8_t ft)
 {
+    invalidateDirIndex(parentInode, pino);
     uint8_t *tmpBuf = (uint8_t *)kmalloc(g_blockSize);
     if (!tmpBuf)
         return false;
@@ -383,45 +1173,12 @@ write:
     return ret;
 }
 
-static int deleteBlockBuffer(uint8_t *bitmap, uint32_t block)
-{
-    if (!block)
-        return EIO;
-    
-    uint32_t blockIndex = block / g_superBlock.s_blocks_per_group;
-    uint32_t blockOffset = block % g_superBlock.s_blocks_per_group;
-    if (blockIndex >= g_blockGroupDescriptorCount)
-        return EPERM;
-
-    // Read the block bitmap
-    if (!readBlock(g_blockGroupDescriptors[blockIndex].bg_block_bitmap, bitmap))
-        return EIO;
-    
-    CLEAR_BIT(bitmap, blockOffset - 1);
-    g_blockGroupDescriptors[blockIndex].bg_free_blocks_count++;
-    writeBlock(g_blockGroupDescriptors[blockIndex].bg_block_bitmap, bitmap);
-    writeBlock(BLOCK_GROUP_START, g_blockGroupDescriptors);
-
-    return ENOER;
-}
-
-static int deleteBlock(uint32_t block)
-{
-    uint8_t *blockBitmap = (uint8_t *)kmalloc(g_blockSize);
-    if (!blockBitmap)
-        return ENOMEM;
-    
-    int ret = deleteBlockBuffer(blockBitmap, block);
-    kfree(blockBitmap);
-
-    return ret;
-}
-
 static int deleteInodeFromDir(Inode_t *parentInode, uint32_t pino, const char *name, uint32_t *ino)
 {
     if (!strcmp(name, FS_PATH_CURR_DIR) || !strcmp(name, FS_PATH_UP_DIR))
         return EACCES;
     
+    invalidateDirIndex(parentInode, pino);
     int ret = ENOENT;
     uint8_t *tmpBuf = (uint8_t *)kmalloc(g_blockSize);
     if (!tmpBuf)
@@ -446,7 +1203,7 @@ static int deleteInodeFromDir(Inode_t *parentInode, uint32_t pino, const char *n
                 if (currentSize == 0 && dir->rec_len >= g_blockSize)  // First and only entry
                 {
                     // Free the current block
-                    ret = deleteBlock(getRealBlock(parentInode, block));
+                    ret = freeBlocks(getRealBlock(parentInode, block), 1);
                     if (ret != ENOER)
                         goto end;
                     
@@ -527,50 +1284,50 @@ static int deleteInode(Inode_t *inode, uint32_t ino)
     CLEAR_BIT(generalBitmap, inodeOffset - 1);
     g_blockGroupDescriptors[inodeIndex].bg_free_inodes_count++;
     writeBlock(g_blockGroupDescriptors[inodeIndex].bg_inode_bitmap, generalBitmap);
-    writeBlock(BLOCK_GROUP_START, g_blockGroupDescriptors);
+    g_descriptorsDirty = true;
+    kfree(generalBitmap);
     
+    discardPrealloc(inode);
     if (inode->i_size == 0)
-    {
-        kfree(generalBitmap);
         return ENOER;
-    }
     
-    // Delete data blocks
+    // Delete data blocks, a run at a time
     uint32_t endBlock = inode->i_size / g_blockSize;
     if (inode->i_size % g_blockSize != 0)
         endBlock++;
     
-    for (uint32_t block = 0; block < endBlock; block++)
+    for (uint32_t block = 0, run; block < endBlock; block += run)
     {
-        int ret = deleteBlockBuffer(generalBitmap, getRealBlock(inode, block));
+        uint32_t real = mapBlock(inode, block, &run);
+        run = MIN(run, endBlock - block);
+        
+        int ret = freeBlocks(real, run);
         if (ret != ENOER)
-        {
-            kfree(generalBitmap);
             return ret;
-        }
     }
 
-    kfree(generalBitmap);
+    dropExtents(inode);
     return ENOER;
 }
 
 static Inode_t *createInode(Inode_t *parentInode, const uint32_t pino, const char *name, uint32_t attr, uint32_t ino)
 {
-    Inode_t *inode = readInode(ino);
+    Inode_t *inode = getInode(ino);
     if (!inode)
         return NULL;
     
-    // Write the new inode
+    // Write the new inode, a reused cached inode may still map the blocks of a deleted file
     INIT_INODE(inode);
+    dropExtents(inode);
     if (!writeInode(ino, inode))
     {
-        kfree(inode);
+        putInode(inode);
         return NULL;
     }
 
     if (!insertInodeInDir(parentInode, pino, ino, name, getFileType(attr)))
     {
-        kfree(inode);
+        putInode(inode);
         return NULL;
     }
        
@@ -608,7 +1365,7 @@ found_bit:
         newInoNum = bit + g_inodesPerGroup * i + 1;
         g_blockGroupDescriptors[i].bg_free_inodes_count--;
         writeBlock(g_blockGroupDescriptors[i].bg_inode_bitmap, inodeBitmap);
-        writeBlock(BLOCK_GROUP_START, g_blockGroupDescriptors);
+        g_descriptorsDirty = true;
         
         break;
     }
@@ -623,14 +1380,14 @@ found_bit:
 
 static VfsNode_t *ino2vfs(const uint32_t ino, const char *name)
 {
-    Inode_t *inode = readInode(ino);
+    Inode_t *inode = getInode(ino);
     if (!inode)
         return NULL;
         
     VfsNode_t *node = (VfsNode_t *)kmalloc(sizeof(VfsNode_t));
     if (!node)
     {
-        kfree(inode);
+        putInode(inode);
         return NULL;
     }
     
@@ -644,6 +1401,7 @@ static VfsNode_t *ino2vfs(const uint32_t ino, const char *name)
     node->mtime = inode->i_mtime;
     node->ctime = inode->i_ctime;
     node->offset = 0;
+    node->raOffset = node->raEnd = node->raWindow = 0;
     
     // Set flags
     uint32_t mask = GET_FLAGS(inode->i_mode);
@@ -652,6 +1410,8 @@ static VfsNode_t *ino2vfs(const uint32_t ino, const char *name)
         node->flags |= FS_FILE;
         node->readdir = NULL;
         node->finddir = NULL;
+        node->getnode = NULL;
+        node->getdents = NULL;
         node->create = NULL;
         node->mkdir = NULL;
         node->delete = NULL;
@@ -661,6 +1421,8 @@ static VfsNode_t *ino2vfs(const uint32_t ino, const char *name)
         node->flags |= FS_DIR;
         node->readdir = ext2_readdir;
         node->finddir = ext2_finddir;
+        node->getnode = ext2_getnode;
+        node->getdents = ext2_getdents;
         node->create = ext2_create;
         node->mkdir = ext2_mkdir;
         node->delete = ext2_delete;
@@ -679,28 +1441,30 @@ static VfsNode_t *ino2vfs(const uint32_t ino, const char *name)
     node->write = ext2_write;
     node->open = ext2_open;
     node->close = ext2_close;
+    node->fsync = ext2_fsync;
     
-    kfree(inode);
+    putInode(inode);
     return node;
 }
 
 void ext2_init()
 {
-    assert(ide_read(SUPER_BLOCK_SECTOR, &g_superBlock, sizeof(SuperBlock_t) / ATA_SECTOR_SIZE));
+    assert(block_read(SUPER_BLOCK_SECTOR, &g_superBlock, sizeof(SuperBlock_t) / ATA_SECTOR_SIZE));
     assert(g_superBlock.s_magic == EXT2_SIGNATURE);
     
     g_blockSize = 1024 << g_superBlock.s_log_block_size;
     g_blockGroupDescriptorCount = MAX(g_superBlock.s_blocks_count / g_superBlock.s_blocks_per_group, g_superBlock.s_inodes_count / g_superBlock.s_inodes_per_group);
     g_inodesPerGroup = g_superBlock.s_inodes_count / g_blockGroupDescriptorCount;
     LOG("Ext2 block size: %u\n", g_blockSize);
+    bcache_init(g_blockSize);
     
     // Read group descriptors
-    size_t groupBlockSpan = (g_blockGroupDescriptorCount * sizeof(BlockGroupDescriptor_t)) / g_blockSize + 1;
-    g_blockGroupDescriptors = (BlockGroupDescriptor_t *)kmalloc(g_blockSize * groupBlockSpan);
+    g_groupBlockSpan = (g_blockGroupDescriptorCount * sizeof(BlockGroupDescriptor_t)) / g_blockSize + 1;
+    g_blockGroupDescriptors = (BlockGroupDescriptor_t *)kmalloc(g_blockSize * g_groupBlockSpan);
     assert(g_blockGroupDescriptors);
     
     uint8_t *bufOffset = (uint8_t *)g_blockGroupDescriptors;
-    for (size_t i = 0; i < groupBlockSpan; i++)
+    for (size_t i = 0; i < g_groupBlockSpan; i++)
         assert(readBlock(BLOCK_GROUP_START + i, bufOffset + i * g_blockSize));
     
     // Verify group descriptors
@@ -713,8 +1477,6 @@ void ext2_init()
         LOG("Block group descriptor %d. Block bitmap: %u, Inode bitmap: %u, Inode table: %u, Directories: %u\n", i + 1, group->bg_block_bitmap, group->bg_inode_bitmap, group->bg_inode_table, group->bg_used_dirs_count);
     }
     
-    assert(g_tmpBuf = (uint8_t *)kmalloc(g_blockSize));
-
     // Set ext2 as root filesystem
     assert(_RootFS = ino2vfs(INODE_ROOT, "/"));
     assert((_RootFS->flags & FS_DIR) == FS_DIR);
@@ -723,107 +1485,98 @@ void ext2_init()
 
 ssize_t ext2_read(VfsNode_t *node, uint32_t offset, size_t size, void *buffer)
 {
-    Inode_t *inode = readInode(node->inode);
+    Inode_t *inode = getInode(node->inode);
     if (!inode)
         return -EEXIST;
     if (!INODE_FILE(inode))
     {
-        kfree(inode);
+        putInode(inode);
         return -EISDIR;
     }
     if (size + offset > inode->i_size)
     {
-        kfree(inode);
+        putInode(inode);
         return -ESPIPE;
     }
     
-    uint8_t *tmpBuf = (uint8_t *)kmalloc(g_blockSize);
-    if (!tmpBuf)
+    // Direct reads transfer whole blocks between the disk and the caller only
+    bool direct = (node->attr & O_DIRECT) == O_DIRECT;
+    if (direct && (offset % g_blockSize || size % g_blockSize || (uint64_t)buffer % ATA_SECTOR_SIZE))
     {
-        kfree(inode);
-        return -ENOMEM;
+        putInode(inode);
+        return -EINVAL;
     }
     
     ssize_t readBytes = 0;
-    uint32_t startBlock = offset / g_blockSize;
-    uint32_t endBlock = (offset + size) / g_blockSize;
-    
+    uint64_t end = (uint64_t)offset + size;
     uint8_t *pBuf = (uint8_t *)buffer;
-    for (uint32_t block = startBlock; block <= endBlock; block++)
+    while ((uint64_t)offset + readBytes < end)
     {
-        // Handle offset in case of starting or ending block
-        if (block == startBlock)
+        uint32_t position = offset + readBytes;
+        uint32_t block = position / g_blockSize;
+        uint32_t intrnOffset = position % g_blockSize;
+        uint32_t intrnCount = MIN(g_blockSize - intrnOffset, end - position);
+        if (intrnCount < g_blockSize)
         {
-            if (!readInodeBlock(inode, block, tmpBuf))
+            // Copy the part of a starting or ending block out of the cache
+            BufferHead_t *bh = bcache_get(getRealBlock(inode, block), true);
+            if (!bh)
             {
                 readBytes = -EIO;
                 goto end;
             }
             
-            uint32_t intrnOffset = offset % g_blockSize;
-            uint32_t intrnCount = 0;
-            if (size + intrnOffset <= g_blockSize)
-                intrnCount = size;
-            else
-                intrnCount = g_blockSize - intrnOffset;
-            
-            memcpy(pBuf, tmpBuf + intrnOffset, intrnCount);
+            memcpy(pBuf + readBytes, bh->data + intrnOffset, intrnCount);
+            bcache_release(bh);
             readBytes += intrnCount;
+            continue;
         }
-        else if (block == endBlock)
-        {
-            if (!readInodeBlock(inode, block, tmpBuf))
-            {
-                readBytes = -EIO;
-                goto end;
-            }
-            
-            uint32_t remainingBytes = (offset + size) % g_blockSize;
-            memcpy(pBuf + readBytes, tmpBuf, remainingBytes);
-            readBytes += remainingBytes;
-        }
-        else
+        
+        // Read the run of contiguous whole blocks, direct reads bypass the cache
+        uint32_t run;
+        uint32_t real = mapBlock(inode, block, &run);
+        run = MIN(run, (end - position) / g_blockSize);
+        if (!bcache_readBlocks(real, run, pBuf + readBytes, direct))
         {
-            // Read directly into the buffer
-            if (!readInodeBlock(inode, block, pBuf + readBytes))
-            {
-                readBytes = -EIO;
-                goto end;
-            }
-
-            readBytes += g_blockSize;
+            readBytes = -EIO;
+            goto end;
         }
+        
+        readBytes += run * g_blockSize;
     }
     
+    // Direct readers manage their own buffering
+    if (!direct)
+        readAhead(node, inode, offset, offset + readBytes);
+    
     node->offset = offset + readBytes;  // Update offset
-
+    
 end:
-    kfree(inode);
-    kfree(tmpBuf);
+    putInode(inode);
     return readBytes;
 }
 
 ssize_t ext2_write(VfsNode_t *node, uint32_t offset, size_t size, void *buffer)
 {
-    Inode_t *inode = readInode(node->inode);
+    Inode_t *inode = getInode(node->inode);
     uint32_t osize = inode->i_size;
     if (!inode)
         return -EEXIST;
     if (!INODE_FILE(inode))
     {
-        kfree(inode);
+        putInode(inode);
         return -EISDIR;
     }
     if (offset > inode->i_size)
     {
-        kfree(inode);
+        putInode(inode);
         return -ESPIPE;
     }
 
     uint8_t *tmpBuf = (uint8_t *)kmalloc(g_blockSize);
     if (!tmpBuf)
     {
-        kfree(inode);
+        putInode(inode);
         return -ENOMEM;
     }
     
@@ -912,7 +1665,7 @@ end:
     node->offset = offset + writtenBytes;
     
 cleanup:
-    kfree(inode);
+    putInode(inode);
     kfree(tmpBuf);
     return writtenBytes;
 }
@@ -925,112 +1678,122 @@ void ext2_open(VfsNode_t *node, uint32_t attr)
 
 void ext2_close(VfsNode_t *node)
 {
-    UNUSED(node);
+    // Give back the blocks reserved for the file to grow into
+    Inode_t *inode = getInode(node->inode);
+    if (!inode)
+        return;
+    
+    discardPrealloc(inode);
+    putInode(inode);
 }
 
 struct dirent *ext2_readdir(VfsNode_t *node, uint32_t index)
 {
-    Inode_t *inode = readInode(node->inode);
+    Inode_t *inode = getInode(node->inode);
     if (!inode)
         return NULL;
     if (!INODE_DIR(inode))
     {
-        kfree(inode);
+        putInode(inode);
         return NULL;
     }
     
-    uint8_t *tmpBuf = (uint8_t *)kmalloc(g_blockSize);
-    if (!tmpBuf)
+    DirIndex_t *dirIndex = getDirIndex(inode);
+    if (!dirIndex || index >= dirIndex->count)
     {
-        kfree(inode);
+        putInode(inode);
         return NULL;
     }
     
-    // Iterate all blocks
-    uint32_t i = 0;
-    struct dirent *foundDir = NULL;
-    for (uint32_t block = 0; block < inode->i_size / g_blockSize; block++)
+    struct dirent *foundDir = (struct dirent *)kmalloc(sizeof(struct dirent));
+    if (foundDir)
     {
-        if (!readInodeBlock(inode, block, tmpBuf))
-            goto end;
-        
-        Directory_t *dir = (Directory_t *)tmpBuf;
-        uint32_t currentSize = 0;
-        while (true)
-        {
-            if (i == index)     // Found the entry
-            {
-                foundDir = (struct dirent *)kmalloc(sizeof(struct dirent));
-                if (!foundDir)
-                    goto end;
-                
-                foundDir->ino = dir->inode;
-                strcpy(foundDir->name, dir->name);
-                goto end;
-            }
-            
-            i++;
-            currentSize += dir->rec_len;
-            if (currentSize >= g_blockSize)
-                break;
-
-            dir = (Directory_t *)(((uint8_t *)dir) + dir->rec_len);
-        }
+        foundDir->ino = dirIndex->entries[index]->ino;
+        strcpy(foundDir->name, dirIndex->entries[index]->name);
     }
-
-end:
-    kfree(inode);
-    kfree(tmpBuf);
+    
+    putInode(inode);
     return foundDir;
 }
 
-VfsNode_t *ext2_finddir(VfsNode_t *node, const char *name)
+ssize_t ext2_getdents(VfsNode_t *node, struct dirent *dirents, size_t count)
 {
-    Inode_t *inode = readInode(node->inode);
+    Inode_t *inode = getInode(node->inode);
     if (!inode)
-        return NULL;
+        return -ENOENT;
     if (!INODE_DIR(inode))
     {
-        kfree(inode);
-        return NULL;
+        putInode(inode);
+        return -ENOTDIR;
     }
     
-    uint8_t *tmpBuf = (uint8_t *)kmalloc(g_blockSize);
-    if (!tmpBuf)
-    {
-        kfree(inode);
-        return NULL;
-    }
-
-    // Iterate all blocks
-    VfsNode_t *foundNode = NULL;
-    for (uint32_t block = 0; block < inode->i_size / g_blockSize; block++)
+    // Continue a single pass over the directory blocks from the cursor
+    ssize_t filled = 0;
+    uint32_t position = node->offset;
+    while ((size_t)filled < count && position < inode->i_size)
     {
-        if (!readInodeBlock(inode, block, tmpBuf))
-            goto end;
+        uint32_t block = position / g_blockSize, offset = position % g_blockSize;
+        BufferHead_t *bh = bcache_get(getRealBlock(inode, block), true);
+        if (!bh)
+        {
+            if (!filled)
+                filled = -EIO;
+            
+            break;
+        }
         
-        Directory_t *dir = (Directory_t *)tmpBuf;
-        uint32_t currentSize = 0;
-        while (true)
+        while ((size_t)filled < count && offset + sizeof(Directory_t) <= g_blockSize)
         {
-            if (!strcmp(dir->name, name))     // Found the entry
+            Directory_t *dir = (Directory_t *)(bh->data + offset);
+            if (dir->rec_len < sizeof(Directory_t))
             {
-                foundNode = ino2vfs(dir->inode, dir->name);
-                goto end;
+                offset = g_blockSize;
+                break;
+            }
+            if (dir->inode)
+            {
+                dirents[filled].ino = dir->inode;
+                memcpy(dirents[filled].name, dir->name, dir->name_len);
+                dirents[filled].name[dir->name_len] = '\0';
+                filled++;
             }
             
-            currentSize += dir->rec_len;
-            if (currentSize >= g_blockSize)
-                break;
-
-            dir = (Directory_t *)(((uint8_t *)dir) + dir->rec_len);
+            offset += dir->rec_len;
         }
+        
+        bcache_release(bh);
+        if (offset + sizeof(Directory_t) > g_blockSize)   // Block is done
+            position = (block + 1) * g_blockSize;
+        else
+            position = block * g_blockSize + offset;
     }
+    
+    node->offset = position;
+    putInode(inode);
+    return filled;
+}
 
-end:
-    kfree(inode);
-    kfree(tmpBuf);
-    return foundNode;
+VfsNode_t *ext2_finddir(VfsNode_t *node, const char *name)
+{
+    Inode_t *inode = getInode(node->inode);
+    if (!inode)
+        return NULL;
+    if (!INODE_DIR(inode))
+    {
+        putInode(inode);
+        return NULL;
+    }
+    
+    uint32_t ino = findEntry(inode, name);
+    putInode(inode);
+    
+    return ino ? ino2vfs(ino, name) : NULL;
+}
+
+VfsNode_t *ext2_getnode(VfsNode_t *node, uint32_t ino, const char *name)
+{
+    UNUSED(node);
+    return ino2vfs(ino, name);
 }
 
 int ext2_create(VfsNode_t *node, const char *name, uint32_t attr)
@@ -1042,23 +1805,23 @@ int ext2_create(VfsNode_t *node, const char *name, uint32_t attr)
         return EEXIST;
     }
     
-    Inode_t *parentInode = readInode(node->inode);
+    Inode_t *parentInode = getInode(node->inode);
     if (!parentInode)
         return ENOENT;
     if (!INODE_DIR(parentInode))
     {
-        kfree(parentInode);
+        putInode(parentInode);
         return ENOTDIR;
     }
     
     // Create the new file
     uint32_t newIno;
     Inode_t *newInode = allocateAndCreateInode(parentInode, node->inode, name, (attr & ~I_DIR) | I_FILE, &newIno);
-    kfree(parentInode);
+    putInode(parentInode);
     if (!newInode)
         return EPERM;
     
-    kfree(newInode);
+    putInode(newInode);
     return ENOER;
 }
 
@@ -1071,16 +1834,19 @@ int ext2_mkdir(VfsNode_t *node, const char *name, uint32_t attr)
         return EEXIST;
     }
     
-    Inode_t *parentInode = readInode(node->inode);
+    Inode_t *parentInode = getInode(node->inode);
     if (!parentInode)
         return ENOENT;
     if (!INODE_DIR(parentInode))
+    {
+        putInode(parentInode);
         return ENOTDIR;
+    }
     
     // Create the new file
     uint32_t newIno, eino;
     Inode_t *newInode = allocateAndCreateInode(parentInode, node->inode, name, (attr & ~I_FILE) | I_DIR, &newIno);
-    kfree(parentInode);
+    putInode(parentInode);
     if (!newInode)
         return EPERM;
     
@@ -1088,32 +1854,32 @@ int ext2_mkdir(VfsNode_t *node, const char *name, uint32_t attr)
     Inode_t *currentDirectoryInode = allocateAndCreateInode(newInode, newIno, FS_PATH_CURR_DIR, I_FILE, &eino);
     if (!currentDirectoryInode)
     {
-        kfree(currentDirectoryInode);
+        putInode(newInode);
         return EPERM;
     }
-    kfree(currentDirectoryInode);
+    putInode(currentDirectoryInode);
     
     // Create parent directory pointer (inode - parent directory)
     Inode_t *previousDirectoryInode = allocateAndCreateInode(newInode, newIno, FS_PATH_UP_DIR, I_FILE, &eino);
     if (!previousDirectoryInode)
     {
-        kfree(previousDirectoryInode);
+        putInode(newInode);
         return EPERM;
     }
     
-    kfree(previousDirectoryInode);
-    kfree(newInode);
+    putInode(previousDirectoryInode);
+    putInode(newInode);
     return ENOER;
 }
 
 int ext2_delete(VfsNode_t *node, const char *name)
 {
-    Inode_t *parentInode = readInode(node->inode);
+    Inode_t *parentInode = getInode(node->inode);
     if (!parentInode)
         return ENOENT;
     if (!INODE_DIR(parentInode))
     {
-        kfree(parentInode);
+        putInode(parentInode);
         return ENOTDIR;
     }
     
@@ -1122,23 +1888,43 @@ int ext2_delete(VfsNode_t *node, const char *name)
     int ret = deleteInodeFromDir(parentInode, node->inode, name, &cino);
     if (ret != ENOER)
     {
-        kfree(parentInode);
+        putInode(parentInode);
         return ret;
     }
-    kfree(parentInode);
+    putInode(parentInode);
     
-    Inode_t *cInode = readInode(cino);
+    Inode_t *cInode = getInode(cino);
     if (!cInode)
         return ENOENT;
     if (INODE_DIR(cInode))
     {
-        kfree(cInode);
+        putInode(cInode);
         return EISDIR;
     }
     
-    // Delete the inode
+    // Delete the inode, its cached pages must not be found by a file reusing it
     ret = deleteInode(cInode, cino);
-    kfree(cInode);
+    putInode(cInode);
+    pcache_invalidate(cino);
     
     return ret;
+}
+
+int ext2_sync()
+{
+    mutex_acquire(&g_inodeLock);
+    bool written = true;
+    for (CachedInode_t *entry = g_inodeLruHead; entry; entry = entry->lruNext)
+        written &= writeBackInode(entry);
+    
+    written &= writeDescriptors();
+    mutex_release(&g_inodeLock);
+    return (written && bcache_flush()) ? ENOER : EIO;
+}
+
+int ext2_fsync(VfsNode_t *node)
+{
+    // Blocks aren't tracked per file, write back the whole filesystem
+    UNUSED(node);
+    return ext2_sync();
 }
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include <fs/pcache.h>
+#include <mem/pmm.h>
+#include <mem/heap.h>
+#include <arch/lock.h>
+#include <assert.h>
+#include <libc/string.h>
+
+#define HASH(ino, index)    (((ino) * 31 + (index)) % PCACHE_BUCKETS)
+#define MAX_PAGES           (PCACHE_SIZE / PAGE_SIZE)
+
+static CachedPage_t *g_buckets[PCACHE_BUCKETS];
+static CachedPage_t *g_lruHead, *g_lruTail;    /* Unmapped pages, most recently used at the head. */
+static uint32_t g_pageCount = 0;
+MAKE_SPINLOCK(g_lock);
+
+static void lruRemove(CachedPage_t *page)
+{
+    if (page->lruPrev)
+        page->lruPrev->lruNext = page->lruNext;
+    else if (g_lruHead == page)
+        g_lruHead = page->lruNext;
+    if (page->lruNext)
+        page->lruNext->lruPrev = page->lruPrev;
+    else if (g_lruTail == page)
+        g_lruTail = page->lruPrev;
+
+    page->lruNext = page->lruPrev = NULL;
+}
+
+static void lruPush(CachedPage_t *page)
+{
+    page->lruPrev = NULL;
+    page->lruNext = g_lruHead;
+    if (g_lruHead)
+        g_lruHead->lruPrev = page;
+    else
+        g_lruTail = page;
+
+    g_lruHead = page;
+}
+
+static void freePage(CachedPage_t *page)
+{
+    CachedPage_t **link = &g_buckets[HASH(page->ino, page->index)];
+    while (*link != page)
+        link = &(*link)->hashNext;
+
+    *link = page->hashNext;
+    lruRemove(page);
+    pmm_releaseFrame(page->frame);
+    kfree(page);
+    g_pageCount--;
+}
+
+static CachedPage_t *lookup(const uint32_t ino, const uint32_t index)
+{
+    for (CachedPage_t *page = g_buckets[HASH(ino, index)]; page; page = page->hashNext)
+    {
+        if (page->ino == ino && page->index == index && !page->stale)
+            return page;
+    }
+
+    return NULL;
+}
+
+static void evictPages()
+{
+    // Only pages no process maps are on the LRU list
+    while (g_pageCount >= MAX_PAGES && g_lruTail)
+        freePage(g_lruTail);
+}
+
+void *pcache_get(VfsNode_t *node, const uint32_t index)
+{
+    uint64_t start = (uint64_t)index * PAGE_SIZE;
+    uint32_t size = start < node->size ? MIN(PAGE_SIZE, node->size - start) : 0;
+
+    lock_acquire(&g_lock);
+    CachedPage_t *page = lookup(node->inode, index);
+    if (page)
+    {
+        if (!page->refCount++)
+            lruRemove(page);
+    }
+    else
+    {
+        evictPages();
+        void *frame = pmm_getZeroedFrame();
+        if (!frame || !(page = (CachedPage_t *)kcalloc(sizeof(CachedPage_t))))
+        {
+            if (frame)
+                pmm_releaseFrame(frame);
+
+            lock_release(&g_lock);
+            return NULL;
+        }
+
+        page->ino = node->inode;
+        page->index = index;
+        page->refCount = 1;
+        page->frame = frame;
+        page->hashNext = g_buckets[HASH(page->ino, index)];
+        g_buckets[HASH(page->ino, index)] = page;
+        g_pageCount++;
+    }
+
+    if (page->valid >= size)
+    {
+        lock_release(&g_lock);
+        return page->frame;
+    }
+
+    // Read outside of the lock, writes copy their data to the page meanwhile
+    lock_release(&g_lock);
+    long offset = node->offset;
+    ssize_t read = vfs_read(node, start, size, page->frame);
+    node->offset = offset;
+
+    lock_acquire(&g_lock);
+    if (read == (ssize_t)size)
+        page->valid = MAX(page->valid, size);
+
+    lock_release(&g_lock);
+    if (read == (ssize_t)size)
+        return page->frame;
+
+    pcache_put(node->inode, index, page->frame);
+    return NULL;
+}
+
+bool pcache_put(const uint32_t ino, const uint32_t index, void *frame)
+{
+    lock_acquire(&g_lock);
+
+    // Stale pages are still found by their frame
+    CachedPage_t *page = g_buckets[HASH(ino, index)];
+    while (page && (page->ino != ino || page->index != index || page->frame != frame))
+        page = page->hashNext;
+
+    if (!page)
+    {
+        lock_release(&g_lock);
+        return false;
+    }
+
+    assert(page->refCount > 0);
+    if (!--page->refCount)
+    {
+        if (page->stale)
+            freePage(page);
+        else
+            lruPush(page);
+    }
+
+    lock_release(&g_lock);
+    return true;
+}
+
+void pcache_update(const uint32_t ino, const uint32_t offset, const size_t size, const void *buffer)
+{
+    lock_acquire(&g_lock);
+
+    const uint8_t *src = (const uint8_t *)buffer;
+    uint64_t end = (uint64_t)offset + size;
+    for (uint64_t position = offset; position < end;)
+    {
+        uint32_t pageOffset = position % PAGE_SIZE;
+        uint32_t count = MIN(PAGE_SIZE - pageOffset, end - position);
+        CachedPage_t *page = lookup(ino, position / PAGE_SIZE);
+        if (page)
+        {
+            // The written bytes are current even if the ones before them weren't read yet
+            memcpy((uint8_t *)page->frame + pageOffset, src + (position - offset), count);
+            if (pageOffset <= page->valid)
+                page->valid = MAX(page->valid, pageOffset + count);
+        }
+
+        position += count;
+    }
+
+    lock_release(&g_lock);
+}
+
+void pcache_invalidate(const uint32_t ino)
+{
+    lock_acquire(&g_lock);
+    for (uint32_t i = 0; i < PCACHE_BUCKETS; i++)
+    {
+        CachedPage_t *page = g_buckets[i];
+        while (page)
+        {
+            CachedPage_t *next = page->hashNext;
+            if (page->ino == ino && !page->stale)
+            {
+                page->stale = true;
+                if (!page->refCount)
+                    freePage(page);
+            }
+
+            page = next;
+        }
+    }
+
+    lock_release(&g_lock);
+}
\ No newline at end of file
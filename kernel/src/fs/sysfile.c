@@ -1,10 +1,13 @@
 #include <sys/scheduler.h>
 #include <fs/vfs.h>
 #include <mem/heap.h>
+#include <mem/uaccess.h>
 #include <assert.h>
 #include <logger.h>
 #include <libc/string.h>
 
+#define USER_COPY_CHUNK     (16 * PAGE_SIZE)    /* Largest kernel buffer user data is copied through. */
+
 int sys_open(const char *path, int flags, int mode)
 {
     LOG_PROC("sys_open path `%s` with flags %d (mode %d)\n", path, flags, mode);
@@ -47,8 +50,43 @@ ssize_t sys_read(uint32_t fd, void *buf, size_t count)
     if (fd >= currentProcess()->fdt->length)
         return -ENOENT;
     
+    if (!count)
+        return 0;
+    
     VfsNode_t *node = PROC_FILE_AT(fd);
-    return vfs_read(node, node->offset, count, buf);
+    if (node->attr & O_DIRECT)
+    {
+        // The disk transfers straight to the pages of the process, which only the process itself can unmap
+        if (!access_ok(buf, count, true))
+            return -EFAULT;
+        
+        return vfs_read(node, node->offset, count, buf);
+    }
+    
+    uint8_t *chunk = (uint8_t *)kmalloc(MIN(count, USER_COPY_CHUNK));
+    if (!chunk)
+        return -ENOMEM;
+    
+    ssize_t total = 0;
+    while ((size_t)total < count)
+    {
+        size_t size = MIN(count - total, USER_COPY_CHUNK);
+        ssize_t ret = vfs_read(node, node->offset, size, chunk);
+        if (ret > 0 && !copy_to_user((uint8_t *)buf + total, chunk, ret))
+            ret = -EFAULT;
+        if (ret <= 0)
+        {
+            total = total ? total : ret;
+            break;
+        }
+        
+        total += ret;
+        if ((size_t)ret < size)
+            break;
+    }
+    
+    kfree(chunk);
+    return total;
 }
 
 ssize_t sys_write(uint32_t fd, const void *buf, size_t count)
@@ -60,8 +98,32 @@ ssize_t sys_write(uint32_t fd, const void *buf, size_t count)
     if (fd >= currentProcess()->fdt->length)
         return -ENOENT;
     
+    if (!count)
+        return 0;
+    
+    uint8_t *chunk = (uint8_t *)kmalloc(MIN(count, USER_COPY_CHUNK));
+    if (!chunk)
+        return -ENOMEM;
+    
     VfsNode_t *node = PROC_FILE_AT(fd);
-    return vfs_write(node, node->offset, count, (void *)buf);
+    ssize_t total = 0;
+    while ((size_t)total < count)
+    {
+        size_t size = MIN(count - total, USER_COPY_CHUNK);
+        ssize_t ret = copy_from_user(chunk, (const uint8_t *)buf + total, size) ? vfs_write(node, node->offset, size, chunk) : -EFAULT;
+        if (ret <= 0)
+        {
+            total = total ? total : ret;
+            break;
+        }
+        
+        total += ret;
+        if ((size_t)ret < size)
+            break;
+    }
+    
+    kfree(chunk);
+    return total;
 }
 
 DIR *sys_opendir(const char *name)
@@ -90,6 +152,7 @@ DIR *sys_opendir(const char *name)
     }
     
     dir->currentEntry = 0;
+    dir->bufferedEntries = 0;
     dir->fd = (uint32_t)fd;
     return dir;
 }
@@ -119,6 +182,54 @@ struct dirent *sys_readdir(DIR *dirp)
     return vfs_readdir(node, dirp->currentEntry++);
 }
 
+ssize_t sys_getdents(uint32_t fd, struct dirent *buf, size_t count)
+{
+    LOG_PROC("sys_getdents directory %u to %p (%llu bytes)\n", fd, buf, count);
+    if (!buf)
+        return -EINVAL;
+    if (fd >= currentProcess()->fdt->length)
+        return -ENOENT;
+    
+    if (count < sizeof(struct dirent))
+        return -EINVAL;
+    
+    struct dirent *chunk = (struct dirent *)kmalloc(MIN(count, USER_COPY_CHUNK));
+    if (!chunk)
+        return -ENOMEM;
+    
+    VfsNode_t *node = PROC_FILE_AT(fd);
+    ssize_t total = 0;
+    while (count - total >= sizeof(struct dirent))
+    {
+        size_t size = MIN(count - total, USER_COPY_CHUNK);
+        ssize_t ret = vfs_getdents(node, chunk, size);
+        if (ret > 0 && !copy_to_user((uint8_t *)buf + total, chunk, ret))
+            ret = -EFAULT;
+        if (ret <= 0)
+        {
+            total = total ? total : ret;
+            break;
+        }
+        
+        // A short read is the end of the directory
+        total += ret;
+        if ((size_t)ret < size - size % sizeof(struct dirent))
+            break;
+    }
+    
+    kfree(chunk);
+    return total;
+}
+
+int sys_fsync(uint32_t fd)
+{
+    LOG_PROC("sys_fsync file %u\n", fd);
+    if (fd >= currentProcess()->fdt->length)
+        return -ENOENT;
+    
+    return vfs_fsync(PROC_FILE_AT(fd));
+}
+
 long sys_ftell(uint32_t fd)
 {
     LOG_PROC("sys_ftell from file %u\n", fd);
@@ -188,5 +299,8 @@ char *sys_getcwd(char *buf, size_t size)
     if (!buf || !size)
         return NULL;
     
-    return strncpy(buf, currentProcess()->cwd, size);        
+    // Copy the terminator too, unless the buffer is too small for it
+    const char *cwd = currentProcess()->cwd;
+    size_t length = MIN(strlen(cwd) + 1, size);
+    return copy_to_user(buf, cwd, length) ? buf : NULL;
 }
\ No newline at end of file
@@ -1,11 +1,17 @@
 #include <fs/vfs.h>
+#include <fs/dcache.h>
+#include <fs/pcache.h>
 #include <mem/heap.h>
 #include <sys/scheduler.h>
+#include <sys/mutex.h>
 #include <misc/list.h>
 #include <libc/string.h>
 
 VfsNode_t *_RootFS = NULL;
 
+// Filesystem operations sleep on disk I/O, serialize them between processes
+MAKE_MUTEX(g_fsLock);
+
 char *normalizePath(char *cwd, const char *path)
 {
     char *output = NULL;
@@ -166,7 +172,11 @@ ssize_t vfs_read(VfsNode_t *node, uint32_t offset, size_t size, void *buffer)
     if (!size)
         return 0;
     
-    return node->read(node, offset, size, buffer);
+    mutex_acquire(&g_fsLock);
+    ssize_t ret = node->read(node, offset, size, buffer);
+    mutex_release(&g_fsLock);
+    
+    return ret;
 }
 
 ssize_t vfs_write(VfsNode_t *node, uint32_t offset, size_t size, void *buffer)
@@ -178,7 +188,14 @@ ssize_t vfs_write(VfsNode_t *node, uint32_t offset, size_t size, void *buffer)
     if (!size)
         return 0;
     
-    return node->write(node, offset, size, buffer);
+    mutex_acquire(&g_fsLock);
+    ssize_t ret = node->write(node, offset, size, buffer);
+    if (ret > 0)    // Mapped pages of the file see the new data
+        pcache_update(node->inode, offset, ret, buffer);
+    
+    mutex_release(&g_fsLock);
+    
+    return ret;
 }
 
 void vfs_open(VfsNode_t *node, uint32_t attr)
@@ -189,8 +206,13 @@ void vfs_open(VfsNode_t *node, uint32_t attr)
 
 void vfs_close(VfsNode_t *node)
 {
-    if (node && node->close && node != _RootFS)
-        node->close(node);
+    if (!node || !node->close || node == _RootFS)
+        return;
+    
+    // Closing a file releases the blocks reserved for it
+    mutex_acquire(&g_fsLock);
+    node->close(node);
+    mutex_release(&g_fsLock);
 }
 
 struct dirent *vfs_readdir(VfsNode_t *node, uint32_t index)
@@ -200,7 +222,11 @@ struct dirent *vfs_readdir(VfsNode_t *node, uint32_t index)
     if ((node->flags & FS_DIR) != FS_DIR)
         return NULL;
     
-    return node->readdir(node, index);
+    mutex_acquire(&g_fsLock);
+    struct dirent *ret = node->readdir(node, index);
+    mutex_release(&g_fsLock);
+    
+    return ret;
 }
 
 VfsNode_t *vfs_finddir(VfsNode_t *node, const char *name)
@@ -210,7 +236,37 @@ VfsNode_t *vfs_finddir(VfsNode_t *node, const char *name)
     if ((node->flags & FS_DIR) != FS_DIR)
         return NULL;
     
-    return node->finddir(node, name);
+    mutex_acquire(&g_fsLock);
+    VfsNode_t *found;
+    uint32_t ino;
+    if (!node->getnode)
+        found = node->finddir(node, name);
+    else if (dcache_lookup(node->inode, name, &ino))   // Resolve from the dentry cache
+        found = ino == DCACHE_NEGATIVE ? NULL : node->getnode(node, ino, name);
+    else
+    {
+        found = node->finddir(node, name);
+        dcache_insert(node->inode, name, found ? found->inode : DCACHE_NEGATIVE);
+    }
+    
+    mutex_release(&g_fsLock);
+    return found;
+}
+
+ssize_t vfs_getdents(VfsNode_t *node, struct dirent *buffer, size_t size)
+{
+    if (!node || !node->getdents)
+        return -EPERM;
+    if ((node->flags & FS_DIR) != FS_DIR)
+        return -ENOTDIR;
+    if (size < sizeof(struct dirent))
+        return -EINVAL;
+    
+    mutex_acquire(&g_fsLock);
+    ssize_t entries = node->getdents(node, buffer, size / sizeof(struct dirent));
+    mutex_release(&g_fsLock);
+    
+    return entries < 0 ? entries : entries * (ssize_t)sizeof(struct dirent);
 }
 
 static int getParent(const char *name, uint32_t attr, VfsNode_t **parent, const char **fileName)
@@ -269,11 +325,14 @@ int vfs_create(const char *name, uint32_t attr)
     if (!parent || !fileName)
         return EPERM;
     
+    mutex_acquire(&g_fsLock);
     if (parent->create)
         ret = parent->create(parent, fileName, attr);
     else
         ret = EPERM;
     
+    dcache_invalidate(parent->inode);
+    mutex_release(&g_fsLock);
     kfree(parent);
     return ret;
 }
@@ -289,11 +348,14 @@ int vfs_mkdir(const char *name, uint32_t attr)
     if (!parent || !fileName)
         return EPERM;
     
+    mutex_acquire(&g_fsLock);
     if (parent->mkdir)
         ret = parent->mkdir(parent, fileName, attr);
     else
         ret = EPERM;
     
+    dcache_invalidate(parent->inode);
+    mutex_release(&g_fsLock);
     kfree(parent);
     return ret;
 }
@@ -344,11 +406,28 @@ int vfs_delete(const char *name)
     if (!parent || !fileName)
         return EPERM;
     
+    mutex_acquire(&g_fsLock);
     if (parent->delete)
         ret = parent->delete(parent, fileName);
     else
         ret = EPERM;
     
+    dcache_invalidate(parent->inode);
+    mutex_release(&g_fsLock);
     kfree(parent);
     return ret;
+}
+
+int vfs_fsync(VfsNode_t *node)
+{
+    if (!node)
+        return -EPERM;
+    if (!node->fsync)
+        return -EINVAL;
+    
+    mutex_acquire(&g_fsLock);
+    int ret = node->fsync(node);
+    mutex_release(&g_fsLock);
+    
+    return ret == ENOER ? ENOER : -ret;
 }
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include <mem/pmm.h>
 #include <mem/vmm.h>
 #include <mem/heap.h>
+#include <mem/slab.h>
 #include <dev/pit.h>
 #include <dev/ps2/kbd.h>
 #include <dev/timer.h>
@@ -50,6 +51,9 @@ void bsp_init()
     void *kstack = vmm_createIdentityPages(_KernelPML4, CORE_STACK_SIZE / PAGE_SIZE, VMM_KERNEL_ATTRIBUTES);
     assert(kstack);
     bsp->stack = (uint64_t)kstack + CORE_STACK_SIZE;
+    gdt_initCore(bsp);
+    apic_set_core(bsp);
+    _CoresReady = true;
 }
 
 int _entry(BootInfo_t *bootInfo)
@@ -72,6 +76,7 @@ int _entry(BootInfo_t *bootInfo)
     pmm_init(bootInfo->mmap, bootInfo->mmapSize, bootInfo->mmapDescriptorSize, bootInfo->fb);
     vmm_init(bootInfo->fb);
     heap_init();
+    slab_init();
     
     // Initialize interrupts
     gdt_load();
@@ -98,14 +103,6 @@ int _entry(BootInfo_t *bootInfo)
     ide_init(ATA_DEVICE);   // Initialize disk controller
     ext2_init();            // Initialize root filesystem
     
-    // Initialize APIC & IO APIC
-    madt_init();
-    apic_init();
-    ioapic_init();
-
-    // Initialize other cores    
-    smp_init();
-    
     // Initialize user-space related 
     syscalls_init();
     Process_t *idle = process_init();
@@ -126,14 +123,21 @@ int _entry(BootInfo_t *bootInfo)
 int ap_entry(CoreContext_t *context)
 {
     LOG("[Core %u] Online\n", context->id);
+    apic_set_core(context);
     gdt_load();
     idt_load();
     apic_set_registers();
+    syscalls_initCore();
     LOG("[Core %u] Initialized\n", context->id);
     
-    // For for bsp to finish initialization
+    // Wait for bsp to finish initialization
     while (lock_used(&g_coreLock))
         __PAUSE();
     
-    __HCF();
+    // Take processes from the run queues, starting with the idle process of the core
+    LOG("[Core %u] Scheduling\n", context->id);
+    lapic_timer_periodic(1);
+    yield(NULL);
+    
+    panic("Unreachable");
 }
\ No newline at end of file
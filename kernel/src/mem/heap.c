@@ -1,6 +1,8 @@
 #include <mem/heap.h>
 #include <mem/vmm.h>
+#include <mem/slab.h>
 #include <arch/lock.h>
+#include <arch/apic/apic.h>
 #include <assert.h>
 #include <libc/string.h>
 #include <logger.h>
@@ -155,6 +157,7 @@ typedef struct Chunk_t
 
 Chunk_t *g_freeChunks[NUM_SIZES] = { NULL };
 Chunk_t *g_first = NULL, *g_last = NULL;
+static uint64_t g_heapEnd = KERNEL_HEAP_START;
 
 static void memory_chunk_init(Chunk_t *chunk)
 {
@@ -196,14 +199,89 @@ static void push_free(Chunk_t *chunk)
     DLIST_PUSH(&g_freeChunks[n], chunk, free);
 }
 
+static void release_chunk(Chunk_t *chunk)
+{
+    Chunk_t *prev = CONTAINER(Chunk_t, all, chunk->all.prev);
+    if (prev->used == 0)
+    {
+        remove_free(prev);
+        dlist_remove(&chunk->all);
+        push_free(prev);
+    }
+    else
+    {
+        chunk->used = 0;
+        DLIST_INIT(chunk, free);
+        push_free(chunk);
+    }
+}
+
+static bool grow_heap(size_t size)
+{
+    // Map enough pages for the request to land in a large enough bucket
+    uint64_t bytes = MAX(2 * (size + sizeof(Chunk_t)), KERNEL_HEAP_GROW);
+    uint64_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (g_heapEnd + pages * PAGE_SIZE > KERNEL_HEAP_END)
+        return false;
+    if (!vmm_createPages(_KernelPML4, (void *)g_heapEnd, pages, VMM_USER_ATTRIBUTES))
+        return false;
+    
+    g_heapEnd += pages * PAGE_SIZE;
+    
+    // Move the end marker to the new end, the old one becomes free space
+    Chunk_t *chunk = g_last;
+    g_last = ((Chunk_t *)g_heapEnd) - 1;
+    memory_chunk_init(g_last);
+    g_last->used = 1;
+    dlist_insert_after(&chunk->all, &g_last->all);
+    release_chunk(chunk);
+    
+    LOG("Kernel heap grew to %p (%llu pages added)\n", g_heapEnd, pages);
+    return true;
+}
+
+static void trim_heap()
+{
+    // Unmapping only flushes the TLB of this core, other cores could still reach a released frame once it's reused.
+    // Trimming would need a shootdown, which can't be waited for while they spin on the heap lock with interrupts disabled
+    if (_CoreCount > 1)
+        return;
+    
+    Chunk_t *tail = CONTAINER(Chunk_t, all, g_last->all.prev);
+    if (tail->used)
+        return;
+    
+    // Keep some slack mapped so that alternating alloc/free doesn't thrash the page tables
+    uint64_t newEnd = ((uint64_t)tail + 2 * sizeof(Chunk_t) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    newEnd = MAX(newEnd + KERNEL_HEAP_GROW, KERNEL_HEAP_START + KERNEL_HEAP_INITIAL);
+    if (newEnd >= g_heapEnd || g_heapEnd - newEnd < KERNEL_HEAP_TRIM)
+        return;
+    
+    // Move the end marker back and shrink the tail chunk
+    remove_free(tail);
+    dlist_remove(&g_last->all);
+    g_last = ((Chunk_t *)newEnd) - 1;
+    memory_chunk_init(g_last);
+    g_last->used = 1;
+    dlist_insert_after(&tail->all, &g_last->all);
+    push_free(tail);
+    
+    uint64_t pages = (g_heapEnd - newEnd) / PAGE_SIZE;
+    vmm_unmapPages(_KernelPML4, (void *)newEnd, pages);
+    g_heapEnd = newEnd;
+    
+    LOG("Kernel heap shrank to %p (%llu pages released)\n", g_heapEnd, pages);
+}
+
 void heap_init()
 {
-    uint64_t pages = KERNEL_HEAP_SIZE / PAGE_SIZE;
-    vmm_createPages(_KernelPML4, (void *)KERNEL_HEAP_START, pages, VMM_USER_ATTRIBUTES);
-    LOG("Kernel heap at %p - %p (%llu pages)\n", KERNEL_HEAP_START, KERNEL_HEAP_END, pages);
+    uint64_t pages = KERNEL_HEAP_INITIAL / PAGE_SIZE;
+    assert(vmm_createPages(_KernelPML4, (void *)KERNEL_HEAP_START, pages, VMM_USER_ATTRIBUTES));
+    g_heapEnd = KERNEL_HEAP_START + KERNEL_HEAP_INITIAL;
+    LOG("Kernel heap at %p - %p (%llu pages mapped, grows up to %p)\n", KERNEL_HEAP_START, g_heapEnd, pages, KERNEL_HEAP_END);
     
     char *memStart = (char *)(((intptr_t)KERNEL_HEAP_START + ALIGN - 1) & (~(ALIGN - 1)));
-    char *memEnd = (char *)(((intptr_t)KERNEL_HEAP_START + KERNEL_HEAP_SIZE) & (~(ALIGN - 1)));
+    char *memEnd = (char *)(((intptr_t)g_heapEnd) & (~(ALIGN - 1)));
     g_first = (Chunk_t *)memStart;
     Chunk_t *second = g_first + 1;
     g_last = ((Chunk_t *)memEnd) - 1;
@@ -223,6 +301,11 @@ void heap_init()
 
 __MALLOC__ void *kmalloc(size_t size)
 {
+    // Small allocations are served by the per-CPU slab caches
+    void *obj = kmem_alloc(size);
+    if (obj)
+        return obj;
+    
     size = (size + ALIGN - 1) & (~(ALIGN - 1));
     if (size < MIN_SIZE)
         size = MIN_SIZE;
@@ -240,8 +323,14 @@ __MALLOC__ void *kmalloc(size_t size)
         ++n;
         if (n >= NUM_SIZES)
         {
-            lock_release(&g_lock);
-            return NULL;
+            // Map more memory at the end of the heap and retry
+            if (!grow_heap(size))
+            {
+                lock_release(&g_lock);
+                return NULL;
+            }
+            
+            n = memory_chunk_slot(size - 1) + 1;
         }
     }
     
@@ -279,16 +368,22 @@ __MALLOC__ void *krealloc(void *addr, size_t ns)
     if (!addr)
         return NULL;
     
-    lock_acquire(&g_lock);
-    Chunk_t *chunk = (Chunk_t *)((char *)addr - HEADER_SIZE);
-    size_t chunkSize = memory_chunk_size(chunk);
-    lock_release(&g_lock);
+    size_t chunkSize;
+    if (IS_SLAB_ADDRESS(addr))
+        chunkSize = kmem_cache_of(addr)->objectSize;
+    else
+    {
+        lock_acquire(&g_lock);
+        Chunk_t *chunk = (Chunk_t *)((char *)addr - HEADER_SIZE);
+        chunkSize = memory_chunk_size(chunk);
+        lock_release(&g_lock);
+    }
 
     void *ptr = kmalloc(ns);
     if (!ptr)
         return NULL;
     
-    memcpy(ptr, addr, chunkSize);
+    memcpy(ptr, addr, MIN(chunkSize, ns));
     kfree(addr);
     return ptr;
 }
@@ -297,30 +392,26 @@ void kfree(void *addr)
 {
     if (!addr)
         return;
+    if (IS_SLAB_ADDRESS(addr))
+    {
+        kmem_cache_free(kmem_cache_of(addr), addr);
+        return;
+    }
     
     lock_acquire(&g_lock);
     Chunk_t *chunk = (Chunk_t *)((char*)addr - HEADER_SIZE);
     assert(chunk->used);
     
     Chunk_t *next = CONTAINER(Chunk_t, all, chunk->all.next);
-    Chunk_t *prev = CONTAINER(Chunk_t, all, chunk->all.prev);
     if (next->used == 0)
     {
         remove_free(next);
         dlist_remove(&next->all);
     }
-    if (prev->used == 0)
-    {
-        remove_free(prev);
-        dlist_remove(&chunk->all);
-        push_free(prev);
-    }
-    else
-    {
-        chunk->used = 0;
-        DLIST_INIT(chunk, free);
-        push_free(chunk);
-    }
+    release_chunk(chunk);
+    
+    // Return the free tail of the heap
+    trim_heap();
     
     lock_release(&g_lock);
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include <mem/mmap.h>
+#include <mem/vmm.h>
+#include <mem/pmm.h>
+#include <mem/heap.h>
+#include <fs/pcache.h>
+#include <sys/scheduler.h>
+#include <libc/string.h>
+#include <logger.h>
+
+#define PAGE_ALIGN(addr)    ((addr) & ~(PAGE_SIZE - 1))
+#define MAPPING_END(map)    ((map)->start + (map)->pages * PAGE_SIZE)
+
+static MemoryMapping_t *findMapping(Process_t *process, const uint64_t addr)
+{
+    for (MemoryMapping_t *mapping = process->mappings; mapping; mapping = mapping->next)
+    {
+        if (addr >= mapping->start && addr < MAPPING_END(mapping))
+            return mapping;
+    }
+
+    return NULL;
+}
+
+static void *copyPage(void *frame)
+{
+    void *copy = pmm_getFrame();
+    if (copy)
+        memcpy(copy, frame, PAGE_SIZE);
+
+    return copy;
+}
+
+static void unmapPages(Process_t *process, MemoryMapping_t *mapping)
+{
+    for (uint64_t i = 0; i < mapping->pages; i++)
+    {
+        void *frame = vmm_detachPage(process->pml4, (void *)(mapping->start + i * PAGE_SIZE));
+
+        // Pages written by the process are private copies
+        if (frame && !pcache_put(mapping->node->inode, mapping->index + i, frame))
+            pmm_releaseFrame(frame);
+    }
+}
+
+bool mmap_contains(Process_t *process, const uint64_t addr)
+{
+    return findMapping(process, addr) != NULL;
+}
+
+bool mmap_fault(Process_t *process, const uint64_t addr, const bool write)
+{
+    MemoryMapping_t *mapping = findMapping(process, addr);
+    if (!mapping || !(mapping->prot & PROT_READ) || (write && !(mapping->prot & PROT_WRITE)))
+        return false;
+
+    uint64_t page = PAGE_ALIGN(addr);
+    uint32_t index = mapping->index + (page - mapping->start) / PAGE_SIZE;
+    void *frame = virt2phys(process->pml4, (void *)page);
+    if (frame && !write)
+        return true;
+    if (frame)
+    {
+        // Write to a shared page of a private mapping, copy it
+        void *copy = copyPage(frame);
+        if (!copy)
+            return false;
+
+        vmm_detachPage(process->pml4, (void *)page);
+        pcache_put(mapping->node->inode, index, frame);
+        vmm_mapPage(process->pml4, copy, (void *)page, VMM_USER_ATTRIBUTES);
+        return true;
+    }
+
+    if (!(frame = pcache_get(mapping->node, index)))
+        return false;
+    if (write)
+    {
+        void *copy = copyPage(frame);
+        pcache_put(mapping->node->inode, index, frame);
+        if (!copy)
+            return false;
+
+        vmm_mapPage(process->pml4, copy, (void *)page, VMM_USER_ATTRIBUTES);
+        return true;
+    }
+
+    // Map the cached page itself, writable mappings copy it on the first write
+    vmm_mapPage(process->pml4, frame, (void *)page, PA_PRESENT | PA_SUPERVISOR);
+    LOG_PROC("Mapped page %u of file %u at %p\n", index, mapping->node->inode, page);
+    return true;
+}
+
+void mmap_releaseAll(Process_t *process)
+{
+    MemoryMapping_t *mapping = process->mappings;
+    while (mapping)
+    {
+        MemoryMapping_t *next = mapping->next;
+        unmapPages(process, mapping);
+        kfree(mapping->node);
+        kfree(mapping);
+
+        mapping = next;
+    }
+
+    process->mappings = NULL;
+}
+
+void *sys_mmap(void *addr, size_t length, int prot, int flags, uint32_t fd, long offset)
+{
+    LOG_PROC("sys_mmap file %u at offset %ld (%llu bytes, prot %d, flags %d)\n", fd, offset, length, prot, flags);
+    UNUSED(addr);   // Mappings are placed by the kernel
+
+    Process_t *current = currentProcess();
+    if (!length || offset < 0 || offset % PAGE_SIZE || !(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+        return (void *)-EINVAL;
+    if ((prot & PROT_WRITE) && (flags & MAP_SHARED))
+        return (void *)-EACCES;     // Mapped pages are never written back to the file
+    if (fd >= current->fdt->length)
+        return (void *)-EBADF;
+
+    VfsNode_t *file = PROC_FILE_AT(fd);
+    if ((file->flags & FS_FILE) != FS_FILE || (file->attr & O_WRONLY))
+        return (void *)-EACCES;
+
+    // Mappings are placed upwards until the user stack
+    uint64_t pages = length / PAGE_SIZE + (length % PAGE_SIZE != 0);
+    if (pages > (USER_STACK_START - current->mmapNext) / PAGE_SIZE)
+        return (void *)-ENOMEM;
+
+    MemoryMapping_t *mapping = (MemoryMapping_t *)kmalloc(sizeof(MemoryMapping_t));
+    if (!mapping)
+        return (void *)-ENOMEM;
+    if (!(mapping->node = (VfsNode_t *)kmalloc(sizeof(VfsNode_t))))
+    {
+        kfree(mapping);
+        return (void *)-ENOMEM;
+    }
+
+    // Pages are mapped on the first access
+    memcpy(mapping->node, file, sizeof(VfsNode_t));
+    mapping->node->attr &= ~O_DIRECT;   // Partial last pages can't be read directly
+    mapping->start = current->mmapNext;
+    mapping->pages = pages;
+    mapping->index = offset / PAGE_SIZE;
+    mapping->prot = prot;
+    mapping->flags = flags;
+    mapping->next = current->mappings;
+    current->mappings = mapping;
+    current->mmapNext = MAPPING_END(mapping);
+
+    return (void *)mapping->start;
+}
+
+int sys_munmap(void *addr, size_t length)
+{
+    LOG_PROC("sys_munmap %p (%llu bytes)\n", addr, length);
+
+    // Only whole mappings are removed
+    Process_t *current = currentProcess();
+    MemoryMapping_t **link = &current->mappings;
+    while (*link && (*link)->start != (uint64_t)addr)
+        link = &(*link)->next;
+
+    MemoryMapping_t *mapping = *link;
+    if (!mapping || (length + PAGE_SIZE - 1) / PAGE_SIZE != mapping->pages)
+        return -EINVAL;
+
+    *link = mapping->next;
+    unmapPages(current, mapping);
+    kfree(mapping->node);
+    kfree(mapping);
+
+    return ENOER;
+}
\ No newline at end of file
@@ -1,104 +1,173 @@
 #include <mem/pmm.h>
 #include <arch/lock.h>
+#include <arch/apic/apic.h>
+#include <arch/cpu.h>
+#include <io/io.h>
 #include <assert.h>
 #include <libc/string.h>
 #include <logger.h>
 
 #define INVALID_FRAME_INDEX UINT64_MAX
+#define ORDER_FREE(order)   ((order) + 1)   /* Value stored for the first frame of a free block. */
+#define ORDER_USED          0
+#define FRAME_CACHE_BATCH   (PMM_FRAME_CACHE_SIZE / 2)
+
+/// @brief Free block, stored inside the first frame of the block.
+typedef struct FREE_BLOCK
+{
+    struct FREE_BLOCK *next;
+    struct FREE_BLOCK *prev;
+} FreeBlock_t;
 
 static MemoryDescriptor_t *g_mmap;
 static uint64_t g_mmapSize, g_mmapDescriptorSize;
-static uint64_t g_bitmapSize, g_bitmapElementSize, g_lastFoundBitmap;
-static uint64_t *g_bitmap;
+static uint64_t g_frameCount, g_freeFrames;
+static uint8_t *g_frameOrders;
+static FreeBlock_t *g_freeLists[PMM_MAX_ORDER + 1];
 MAKE_SPINLOCK(g_lock);
 
-static void setFrame(const uint64_t index)
+static void *g_zeroedFrames[PMM_ZEROED_POOL_SIZE];
+static uint64_t g_zeroedCount = 0;
+MAKE_SPINLOCK(g_zeroedLock);
+
+#define INDEX2BLOCK(index)  ((FreeBlock_t *)((index) * PAGE_SIZE))
+#define BLOCK2INDEX(block)  ((uint64_t)(block) / PAGE_SIZE)
+
+static void pushBlock(const uint64_t index, const uint8_t order)
 {
-    uint64_t pIndex = index / g_bitmapElementSize;
-    uint64_t pBit = index % g_bitmapElementSize;
-    
-    g_bitmap[pIndex] |= (1ULL << pBit);
+    FreeBlock_t *block = INDEX2BLOCK(index);
+    block->prev = NULL;
+    block->next = g_freeLists[order];
+    if (block->next)
+        block->next->prev = block;
+
+    g_freeLists[order] = block;
+    g_frameOrders[index] = ORDER_FREE(order);
 }
 
-static void clearFrame(const uint64_t index)
+static void removeBlock(const uint64_t index, const uint8_t order)
 {
-    uint64_t pIndex = index / g_bitmapElementSize;
-    uint64_t pBit = index % g_bitmapElementSize;
-    
-    g_bitmap[pIndex] &= ~(1ULL << pBit);
+    FreeBlock_t *block = INDEX2BLOCK(index);
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        g_freeLists[order] = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+
+    g_frameOrders[index] = ORDER_USED;
 }
 
-static bool testFrame(const uint64_t i, const uint8_t bit)
+static void freeBlock(uint64_t index, uint8_t order)
 {
-    return g_bitmap[i] & (1ULL << bit);
+    g_freeFrames += 1ULL << order;
+
+    // Merge with the buddy as long as it is free and of the same order
+    while (order < PMM_MAX_ORDER)
+    {
+        uint64_t buddy = index ^ (1ULL << order);
+        if (buddy + (1ULL << order) > g_frameCount || g_frameOrders[buddy] != ORDER_FREE(order))
+            break;
+
+        removeBlock(buddy, order);
+        index = MIN(index, buddy);
+        order++;
+    }
+
+    pushBlock(index, order);
 }
 
-static uint64_t getFrames(const size_t frames)
+static void freeRange(uint64_t index, uint64_t count)
 {
-    lock_acquire(&g_lock);
+    // Split the range into the largest naturally aligned blocks
+    while (count > 0)
+    {
+        uint8_t order = 0;
+        while (order < PMM_MAX_ORDER && !(index & (1ULL << order)) && (2ULL << order) <= count)
+            order++;
+
+        freeBlock(index, order);
+        index += 1ULL << order;
+        count -= 1ULL << order;
+    }
+}
+
+static uint64_t allocateBlock(const uint8_t order)
+{
+    uint8_t current = order;
+    while (current <= PMM_MAX_ORDER && !g_freeLists[current])
+        current++;
+    if (current > PMM_MAX_ORDER)
+        return INVALID_FRAME_INDEX;
+
+    uint64_t index = BLOCK2INDEX(g_freeLists[current]);
+    removeBlock(index, current);
+
+    // Return the upper halves of larger blocks
+    while (current > order)
+    {
+        current--;
+        pushBlock(index + (1ULL << current), current);
+    }
+
+    g_freeFrames -= 1ULL << order;
+    return index;
+}
+
+static void reserveFrame(const uint64_t index)
+{
+    // Find the free block containing the frame
+    uint8_t order = 0;
+    uint64_t head = index;
+    while (g_frameOrders[head] != ORDER_FREE(order))
+    {
+        if (++order > PMM_MAX_ORDER)
+            return; // Already reserved
+
+        head = index & ~((1ULL << order) - 1);
+    }
+
+    removeBlock(head, order);
+    g_freeFrames -= 1ULL << order;
 
-    bool fbFound = false;
-    uint64_t j, index = 0, bCopy = frames;
-    for (uint64_t i = g_lastFoundBitmap; i < g_bitmapSize; i++)
+    // Split the block, keeping free every half that doesn't contain the frame
+    while (order > 0)
     {
-        // Block is not completely used
-        if (g_bitmap[i] != UINT64_MAX)
+        order--;
+        uint64_t half = 1ULL << order;
+        if (index >= head + half)
         {
-            // Search each bit
-            for (j = 0; j < g_bitmapElementSize; j++)
-            {
-                if (!testFrame(i, j))
-                {
-                    // If found the first block
-                    if (!fbFound)
-                    {
-                        fbFound = true;
-                        index = i * g_bitmapElementSize + j;
-                    }
-                    
-                    bCopy--;
-                    if (bCopy == 0)
-                    {
-                        g_lastFoundBitmap = i;
-                        goto found;
-                    }
-                }
-                else    // Block is used
-                {
-                    if (fbFound)    // Already found a couple of blocks
-                    {
-                        // Reset the data and continue looking
-                        fbFound = false;
-                        bCopy = frames;
-                    }
-                }
-            }
+            pushBlock(head, order);
+            head += half;
         }
+        else
+            pushBlock(head + half, order);
+
+        g_freeFrames += half;
     }
+}
 
-    lock_release(&g_lock);
-    if (g_lastFoundBitmap == 0)
-        return INVALID_FRAME_INDEX;
-    
-    g_lastFoundBitmap = 0;
-    return getFrames(frames);
-found:
-    lock_release(&g_lock);
-    return index;
+static uint8_t getOrder(const size_t count)
+{
+    uint8_t order = 0;
+    while ((1ULL << order) < count)
+        order++;
+
+    return order;
 }
 
 void pmm_init(MemoryDescriptor_t *mmap, const uint64_t mmapSize, const uint64_t mmapDescriptorSize, const Framebuffer_t *fb)
 {
     g_mmap = mmap;
     g_mmapSize = mmapSize;
-    g_mmapDescriptorSize = mmapDescriptorSize; 
-    g_bitmapElementSize = sizeof(*g_bitmap) * 8;
-    g_lastFoundBitmap = 0;
-    
+    g_mmapDescriptorSize = mmapDescriptorSize;
+    g_freeFrames = 0;
+    memset(g_freeLists, 0, sizeof(g_freeLists));
+
     uint64_t largestMemSegment = 0;
     MemoryDescriptor_t *largestSegment = NULL;
 
-    // Find largest region to store the bitmap at
+    // Find largest region to store the frame orders at
     for (uint64_t i = 0; i < g_mmapSize / g_mmapDescriptorSize; i++)
     {
         MemoryDescriptor_t *desc = (MemoryDescriptor_t *)((uint64_t)g_mmap + i * g_mmapDescriptorSize);
@@ -106,88 +175,189 @@ void pmm_init(MemoryDescriptor_t *mmap, const uint64_t mmapSize, const uint64_t
         {
             largestMemSegment = desc->numberOfPages;
             largestSegment = desc;
-            
+
             LOG("Physical memory region at %p - %p\n", desc->physicalStart, desc->physicalStart + desc->numberOfPages * PAGE_SIZE);
         }
     }
 
     // Verify a segment was found
     assert(largestSegment && largestMemSegment != 0);
-    
-    // Initialize the bitmap
-    g_bitmapSize = pmm_getMemorySize() / PAGE_SIZE / g_bitmapElementSize;
-    g_bitmap = (uint64_t *)largestSegment->physicalStart;
-    uint64_t bitmapSizeInBytes = g_bitmapSize * sizeof(*g_bitmap);
-    assert(bitmapSizeInBytes < largestMemSegment);  // Segment must be large enough to hold the bitmap
-    LOG("Bitmap at %p (%llu bytes)\n", g_bitmap, bitmapSizeInBytes);
-    
-    // Reserve entire memory
-    memset(g_bitmap, 0xFF, bitmapSizeInBytes);
-
-    // Free usable regions
+
+    // Initialize the frame orders, every frame starts reserved
+    g_frameCount = pmm_getMemorySize() / PAGE_SIZE;
+    g_frameOrders = (uint8_t *)largestSegment->physicalStart;
+    uint64_t ordersPages = (g_frameCount + PAGE_SIZE - 1) / PAGE_SIZE;
+    assert(ordersPages < largestMemSegment);  // Segment must be large enough to hold the frame orders
+    LOG("Frame orders at %p (%llu bytes, max order %u)\n", g_frameOrders, g_frameCount, PMM_MAX_ORDER);
+
+    memset(g_frameOrders, ORDER_USED, g_frameCount);
+
+    // Free usable regions, free blocks store their links in their first frame so the frame orders are left out
     for (uint64_t i = 0; i < g_mmapSize / g_mmapDescriptorSize; i++)
     {
         MemoryDescriptor_t *desc = (MemoryDescriptor_t *)((uint64_t)g_mmap + i * g_mmapDescriptorSize);
-        if (desc->type == MMAP_FREE)
+        if (desc == largestSegment)
+            pmm_unreserveRegion(desc->physicalStart + ordersPages * PAGE_SIZE, desc->numberOfPages - ordersPages);
+        else if (desc->type == MMAP_FREE)
             pmm_unreserveRegion(desc->physicalStart, desc->numberOfPages);
     }
 
-    // Reserve bitmap
-    pmm_reserveRegion((uint64_t)g_bitmap, bitmapSizeInBytes / PAGE_SIZE);
-
     // Reserve framebuffer
-    pmm_reserveRegion((uint64_t)fb->baseAddress, fb->bufferSize / PAGE_SIZE);
-    
+    pmm_reserveRegion((uint64_t)fb->baseAddress, (fb->bufferSize + PAGE_SIZE - 1) / PAGE_SIZE);
+
     // Reserve kernel
     pmm_reserveRegion(0, _KernelEnd / PAGE_SIZE + 1);
+    LOG("Physical memory manager initialized with %llu free frames\n", g_freeFrames);
 }
 
 void *pmm_getFrame()
 {
-    return pmm_getFrames(1);
+    if (!_CoresReady)
+        return pmm_getFrames(1);
+
+    uint64_t flags = __SAVE_INTERRUPTS();
+    FrameCache_t *cache = &currentCPU()->frameCache;
+    if (!cache->count)
+    {
+        // Refill the cache in bulk
+        lock_acquire(&g_lock);
+        uint64_t index;
+        while (cache->count < FRAME_CACHE_BATCH && (index = allocateBlock(0)) != INVALID_FRAME_INDEX)
+            cache->frames[cache->count++] = (void *)(index * PAGE_SIZE);
+
+        lock_release(&g_lock);
+    }
+
+    void *frame = cache->count ? cache->frames[--cache->count] : NULL;
+    __RESTORE_INTERRUPTS(flags);
+
+    return frame;
+}
+
+void *pmm_getZeroedFrame()
+{
+    void *frame = NULL;
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&g_zeroedLock);
+    if (g_zeroedCount)
+        frame = g_zeroedFrames[--g_zeroedCount];
+
+    lock_release(&g_zeroedLock);
+    __RESTORE_INTERRUPTS(flags);
+    if (frame)
+        return frame;
+
+    // Pool is empty, zero inline
+    if ((frame = pmm_getFrame()))
+        memset(frame, 0, PAGE_SIZE);
+
+    return frame;
+}
+
+bool pmm_zeroFreeFrame()
+{
+    if (g_zeroedCount >= PMM_ZEROED_POOL_SIZE)
+        return false;
+
+    void *frame = pmm_getFrame();
+    if (!frame)
+        return false;
+
+    // Zero outside of the lock, the idle loop can be preempted at any point
+    x64_zero_page(frame);
+
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&g_zeroedLock);
+    bool added = g_zeroedCount < PMM_ZEROED_POOL_SIZE;
+    if (added)
+        g_zeroedFrames[g_zeroedCount++] = frame;
+
+    lock_release(&g_zeroedLock);
+    __RESTORE_INTERRUPTS(flags);
+    if (!added)
+        pmm_releaseFrame(frame);
+
+    return added;
 }
 
 void *pmm_getFrames(const size_t count)
 {
-    if (count == 0)
+    if (count == 0 || count > (1ULL << PMM_MAX_ORDER))
         return NULL;
-    
-    uint64_t index = getFrames(count);
+
+    uint8_t order = getOrder(count);
+    lock_acquire(&g_lock);
+
+    uint64_t index = allocateBlock(order);
     if (index == INVALID_FRAME_INDEX)
+    {
+        lock_release(&g_lock);
         return NULL;
-    for (size_t i = 0; i < count; i++)
-        setFrame(index + i);
-            
+    }
+
+    // Give back the frames rounding to a power of two added
+    if (count < (1ULL << order))
+        freeRange(index + count, (1ULL << order) - count);
+
+    lock_release(&g_lock);
     return (void *)(index * PAGE_SIZE);
 }
 
 void pmm_releaseFrame(void *addr)
 {
-    pmm_releaseFrames(addr, 1);
+    if (!_CoresReady)
+    {
+        pmm_releaseFrames(addr, 1);
+        return;
+    }
+
+    assert((uint64_t)addr % PAGE_SIZE == 0 && (uint64_t)addr / PAGE_SIZE < g_frameCount);
+
+    uint64_t flags = __SAVE_INTERRUPTS();
+    FrameCache_t *cache = &currentCPU()->frameCache;
+    if (cache->count == PMM_FRAME_CACHE_SIZE)
+    {
+        // Drain half of the cache in bulk
+        lock_acquire(&g_lock);
+        while (cache->count > PMM_FRAME_CACHE_SIZE - FRAME_CACHE_BATCH)
+            freeBlock(BLOCK2INDEX(cache->frames[--cache->count]), 0);
+
+        lock_release(&g_lock);
+    }
+
+    cache->frames[cache->count++] = addr;
+    __RESTORE_INTERRUPTS(flags);
 }
 
 void pmm_releaseFrames(void *addr, const size_t count)
 {
     uint64_t index = (uint64_t)addr;
-    assert(index % PAGE_SIZE == 0 && index / PAGE_SIZE <= g_bitmapSize);
+    assert(index % PAGE_SIZE == 0 && index / PAGE_SIZE + count <= g_frameCount);
 
-    g_lastFoundBitmap = index / PAGE_SIZE;
-    for (size_t i = 0; i < count; i++)
-        clearFrame(g_lastFoundBitmap + i);
+    lock_acquire(&g_lock);
+    freeRange(index / PAGE_SIZE, count);
+    lock_release(&g_lock);
 }
 
 void pmm_reserveRegion(uint64_t start, const size_t pc)
 {
-    uint64_t roundedStart = RNDWN(start, PAGE_SIZE);
-    for (size_t i = 0; i < pc; i++)
-        setFrame((roundedStart + i * PAGE_SIZE) / PAGE_SIZE);
+    uint64_t first = start / PAGE_SIZE;
+    lock_acquire(&g_lock);
+    for (uint64_t i = first; i < first + pc && i < g_frameCount; i++)
+        reserveFrame(i);
+
+    lock_release(&g_lock);
 }
 
 void pmm_unreserveRegion(uint64_t start, const size_t pc)
 {
-    uint64_t roundedStart = RNDUP(start, PAGE_SIZE);
-    for (size_t i = 0; i < pc; i++)
-        clearFrame((roundedStart + i * PAGE_SIZE) / PAGE_SIZE);
+    uint64_t first = (start + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (first >= g_frameCount)
+        return;
+
+    lock_acquire(&g_lock);
+    freeRange(first, MIN(pc, g_frameCount - first));
+    lock_release(&g_lock);
 }
 
 uint64_t pmm_getMemorySize()
@@ -195,12 +365,17 @@ uint64_t pmm_getMemorySize()
     static uint64_t memorySize = 0;
     if (memorySize > 0)
         return memorySize;
-            
+
     for (uint64_t i = 0; i < g_mmapSize / g_mmapDescriptorSize; i++)
     {
         MemoryDescriptor_t *desc = (MemoryDescriptor_t *)((uint64_t)g_mmap + i * g_mmapDescriptorSize);
         memorySize += desc->numberOfPages * PAGE_SIZE;
     }
-    
+
     return memorySize;
+}
+
+uint64_t pmm_getFreeFrames()
+{
+    return g_freeFrames;
 }
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include <mem/slab.h>
+#include <mem/vmm.h>
+#include <arch/apic/apic.h>
+#include <io/io.h>
+#include <assert.h>
+#include <libc/string.h>
+#include <logger.h>
+
+#define SLAB_HEADER_SIZE    ((sizeof(KmemSlab_t) + KMEM_OBJECT_ALIGN - 1) & ~(KMEM_OBJECT_ALIGN - 1))
+#define SLAB_OF(obj)        ((KmemSlab_t *)((uint64_t)(obj) & ~(PAGE_SIZE - 1)))
+#define MAGAZINE_BATCH      (KMEM_MAGAZINE_SIZE / 2)
+#define SIZE_CLASSES        7
+
+bool _SlabInitialized = false;
+
+static KmemCache_t g_caches[KMEM_MAX_CACHES];
+static KmemCache_t *g_sizeClasses[SIZE_CLASSES];
+static const char *g_sizeClassNames[SIZE_CLASSES] =
+{
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+};
+static uint32_t g_cacheCount = 0;
+
+static uint64_t g_slabBreak = KERNEL_SLAB_START;
+static void *g_freePages = NULL;
+MAKE_SPINLOCK(g_pageLock);
+MAKE_SPINLOCK(g_cacheLock);
+
+static void *allocatePage()
+{
+    lock_acquire(&g_pageLock);
+
+    // Reuse a page released by an empty slab
+    void *page = g_freePages;
+    if (page)
+    {
+        g_freePages = *(void **)page;
+        lock_release(&g_pageLock);
+        return page;
+    }
+
+    // Extend the slab region
+    if (g_slabBreak >= KERNEL_SLAB_END || !vmm_createPage(_KernelPML4, (void *)g_slabBreak, VMM_USER_ATTRIBUTES))
+    {
+        lock_release(&g_pageLock);
+        return NULL;
+    }
+
+    page = (void *)g_slabBreak;
+    g_slabBreak += PAGE_SIZE;
+    lock_release(&g_pageLock);
+
+    return page;
+}
+
+static void releasePage(void *page)
+{
+    lock_acquire(&g_pageLock);
+    *(void **)page = g_freePages;
+    g_freePages = page;
+    lock_release(&g_pageLock);
+}
+
+static void unlinkSlab(KmemCache_t *cache, KmemSlab_t *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        cache->partial = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+
+    slab->next = slab->prev = NULL;
+    slab->partial = false;
+}
+
+static void linkSlab(KmemCache_t *cache, KmemSlab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (cache->partial)
+        cache->partial->prev = slab;
+
+    cache->partial = slab;
+    slab->partial = true;
+}
+
+static KmemSlab_t *createSlab(KmemCache_t *cache)
+{
+    KmemSlab_t *slab = (KmemSlab_t *)allocatePage();
+    if (!slab)
+        return NULL;
+
+    slab->cache = cache;
+    slab->inUse = 0;
+    slab->freeList = NULL;
+
+    // Chain every object into the free list
+    uint8_t *objects = (uint8_t *)slab + SLAB_HEADER_SIZE;
+    for (size_t i = cache->objectsPerSlab; i > 0; i--)
+    {
+        void *obj = objects + (i - 1) * cache->objectSize;
+        *(void **)obj = slab->freeList;
+        slab->freeList = obj;
+    }
+
+    linkSlab(cache, slab);
+    return slab;
+}
+
+static void *allocateObject(KmemCache_t *cache)
+{
+    KmemSlab_t *slab = cache->partial;
+    if (!slab && !(slab = createSlab(cache)))
+        return NULL;
+
+    void *obj = slab->freeList;
+    slab->freeList = *(void **)obj;
+    slab->inUse++;
+    if (!slab->freeList)    // Slab is full
+        unlinkSlab(cache, slab);
+
+    return obj;
+}
+
+static void freeObject(KmemCache_t *cache, void *obj)
+{
+    KmemSlab_t *slab = SLAB_OF(obj);
+    assert(slab->cache == cache && slab->inUse > 0);
+
+    *(void **)obj = slab->freeList;
+    slab->freeList = obj;
+    slab->inUse--;
+
+    if (!slab->partial)
+        linkSlab(cache, slab);
+    else if (slab->inUse == 0 && (cache->partial != slab || slab->next))
+    {
+        // Keep a single empty slab per cache, return the rest
+        unlinkSlab(cache, slab);
+        releasePage(slab);
+    }
+}
+
+static KmemMagazine_t *getMagazine(KmemCache_t *cache)
+{
+    if (!_CoresReady)
+        return NULL;
+
+    return &currentCPU()->magazines[cache->id];
+}
+
+void slab_init()
+{
+    for (uint32_t i = 0; i < SIZE_CLASSES; i++)
+        assert(g_sizeClasses[i] = kmem_cache_create(g_sizeClassNames[i], KMEM_MIN_CLASS << i));
+
+    _SlabInitialized = true;
+    LOG("Slab allocator at %p - %p (%u size classes)\n", KERNEL_SLAB_START, KERNEL_SLAB_END, SIZE_CLASSES);
+}
+
+KmemCache_t *kmem_cache_create(const char *name, const size_t size)
+{
+    size_t objectSize = (MAX(size, sizeof(void *)) + KMEM_OBJECT_ALIGN - 1) & ~(KMEM_OBJECT_ALIGN - 1);
+    if (objectSize > PAGE_SIZE - SLAB_HEADER_SIZE)
+        return NULL;
+
+    lock_acquire(&g_cacheLock);
+    if (g_cacheCount >= KMEM_MAX_CACHES)
+    {
+        lock_release(&g_cacheLock);
+        return NULL;
+    }
+
+    KmemCache_t *cache = &g_caches[g_cacheCount];
+    cache->id = g_cacheCount++;
+    lock_release(&g_cacheLock);
+
+    strncpy(cache->name, name, KMEM_CACHE_NAME - 1);
+    cache->objectSize = objectSize;
+    cache->objectsPerSlab = (PAGE_SIZE - SLAB_HEADER_SIZE) / objectSize;
+    cache->partial = NULL;
+    cache->lock = 0;
+
+    LOG("Created cache `%s` (%llu bytes, %llu objects per slab)\n", cache->name, cache->objectSize, cache->objectsPerSlab);
+    return cache;
+}
+
+__MALLOC__ void *kmem_cache_alloc(KmemCache_t *cache)
+{
+    void *obj = NULL;
+    uint64_t flags = __SAVE_INTERRUPTS();
+
+    KmemMagazine_t *magazine = getMagazine(cache);
+    if (!magazine)
+    {
+        lock_acquire(&cache->lock);
+        obj = allocateObject(cache);
+        lock_release(&cache->lock);
+
+        __RESTORE_INTERRUPTS(flags);
+        return obj;
+    }
+
+    if (!magazine->rounds)
+    {
+        // Refill the magazine in bulk
+        lock_acquire(&cache->lock);
+        while (magazine->rounds < MAGAZINE_BATCH && (obj = allocateObject(cache)))
+            magazine->objects[magazine->rounds++] = obj;
+
+        lock_release(&cache->lock);
+    }
+
+    obj = magazine->rounds ? magazine->objects[--magazine->rounds] : NULL;
+    __RESTORE_INTERRUPTS(flags);
+
+    return obj;
+}
+
+void kmem_cache_free(KmemCache_t *cache, void *obj)
+{
+    if (!obj)
+        return;
+
+    uint64_t flags = __SAVE_INTERRUPTS();
+    KmemMagazine_t *magazine = getMagazine(cache);
+    if (!magazine)
+    {
+        lock_acquire(&cache->lock);
+        freeObject(cache, obj);
+        lock_release(&cache->lock);
+
+        __RESTORE_INTERRUPTS(flags);
+        return;
+    }
+
+    if (magazine->rounds == KMEM_MAGAZINE_SIZE)
+    {
+        // Drain half of the magazine in bulk
+        lock_acquire(&cache->lock);
+        while (magazine->rounds > KMEM_MAGAZINE_SIZE - MAGAZINE_BATCH)
+            freeObject(cache, magazine->objects[--magazine->rounds]);
+
+        lock_release(&cache->lock);
+    }
+
+    magazine->objects[magazine->rounds++] = obj;
+    __RESTORE_INTERRUPTS(flags);
+}
+
+KmemCache_t *kmem_cache_of(void *obj)
+{
+    return SLAB_OF(obj)->cache;
+}
+
+__MALLOC__ void *kmem_alloc(const size_t size)
+{
+    if (!_SlabInitialized || size > KMEM_MAX_CLASS)
+        return NULL;
+
+    uint32_t sizeClass = 0;
+    while ((size_t)(KMEM_MIN_CLASS << sizeClass) < size)
+        sizeClass++;
+
+    return kmem_cache_alloc(g_sizeClasses[sizeClass]);
+}
\ No newline at end of file
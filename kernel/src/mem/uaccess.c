@@ -0,0 +1,76 @@
+#include <mem/uaccess.h>
+#include <mem/vmm.h>
+#include <mem/pmm.h>
+#include <mem/mmap.h>
+#include <sys/scheduler.h>
+#include <logger.h>
+
+extern uint64_t x64_copy_user(void *dst, const void *src, const size_t size);
+extern void x64_copy_user_access();
+extern void x64_copy_user_fault();
+
+static bool faultPage(Process_t *process, const uint64_t page, const bool write)
+{
+    PageTableEntry_t *entry = vmm_getEntry(process->pml4, (void *)page);
+    if (entry && entry->present)
+    {
+        // Identity mapped memory is present too, only pages of the process are accessible
+        if (entry->attr.supervisor && (!write || entry->attr.readWrite))
+            return true;
+        
+        // Writes to shared pages of private mappings copy them
+        return write && mmap_contains(process, page) && mmap_fault(process, page, true);
+    }
+    
+    if (mmap_contains(process, page))
+        return mmap_fault(process, page, write);
+    if (!write)
+        return false;
+    
+    // Map a zeroed page, like a write of the process itself would
+    void *frame = pmm_getZeroedFrame();
+    if (!frame)
+        return false;
+    
+    vmm_mapPage(process->pml4, frame, (void *)page, VMM_USER_ATTRIBUTES);
+    LOG_PROC("Mapped %p to %p\n", page, frame);
+    return true;
+}
+
+bool access_ok(const void *addr, const size_t size, const bool write)
+{
+    Process_t *process = currentProcess();
+    uint64_t start = (uint64_t)addr;
+    if (!process || !addr || start + size < start || start + size > USER_SPACE_END)
+        return false;
+    
+    // Fault in every page now, the kernel mustn't fault on them while holding locks
+    for (uint64_t page = start & ~(PAGE_SIZE - 1); page < start + size; page += PAGE_SIZE)
+    {
+        if (!faultPage(process, page, write))
+            return false;
+    }
+    
+    return true;
+}
+
+bool copy_to_user(void *dst, const void *src, const size_t size)
+{
+    // Pages faulted in may still be unmapped before the copy reaches them
+    return access_ok(dst, size, true) && !x64_copy_user(dst, src, size);
+}
+
+bool copy_from_user(void *dst, const void *src, const size_t size)
+{
+    return access_ok(src, size, false) && !x64_copy_user(dst, src, size);
+}
+
+bool uaccess_fixup(InterruptStack_t *stack)
+{
+    if (stack->rip != (uint64_t)x64_copy_user_access)
+        return false;
+    
+    // The pages were faulted in before the copy, a fault now means they were removed
+    stack->rip = (uint64_t)x64_copy_user_fault;
+    return true;
+}
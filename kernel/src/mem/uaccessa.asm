@@ -0,0 +1,15 @@
+bits 64
+
+global x64_copy_user
+global x64_copy_user_access
+global x64_copy_user_fault
+x64_copy_user:  ; rdi - destination, rsi - source, rdx - size
+    mov rcx, rdx
+x64_copy_user_access:
+    ; the only instruction that may fault on a user page, the page fault handler resumes at the fault label
+    rep movsb
+    xor rax, rax
+    ret
+x64_copy_user_fault:
+    mov rax, rcx    ; bytes left to copy
+    ret
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include <arch/cpu.h>
 #include <arch/lock.h>
 #include <syscall/syscalls.h>
+#include <sys/scheduler.h>
+#include <mem/mmap.h>
+#include <mem/uaccess.h>
 #include <assert.h>
 #include <panic.h>
 #include <libc/string.h>
@@ -42,12 +45,12 @@ static void setEntry(PageTableEntry_t *entry, uint64_t addr, uint64_t attr)
 
 static PageTable_t *createEntry(PageTable_t *pt, uint64_t index, const uint64_t attr)
 {
-    PageTable_t *newPT = (PageTable_t *)pmm_getFrame();
+    PageTable_t *newPT = (PageTable_t *)pmm_getZeroedFrame();
     assert(newPT);
-    memset(newPT, 0, PAGE_SIZE);
 
+    // Access is restricted by the last level, read-only pages mustn't make their neighbours read-only
     PageTableEntry_t *entry = &pt->entries[index];
-    setEntry(entry, (uint64_t)newPT >> 12, attr);
+    setEntry(entry, (uint64_t)newPT >> 12, attr | PA_READ_WRITE);
     
     return newPT;
 }
@@ -56,6 +59,23 @@ static void pageFaultHandler(InterruptStack_t *stack)
 {
     uint64_t virtAddr = READ_CR2();
     uint64_t errCode = stack->errorCode;
+    
+    // Pages of mapped files are read from the page cache
+    Process_t *process = currentProcess();
+    if (process && (errCode & PF_USER) && mmap_contains(process, virtAddr))
+    {
+        if (!mmap_fault(process, virtAddr, errCode & PF_WRITABLE))
+        {
+            LOG_PROC("Terminated process because of an illegal access to a mapped file at %p (0x%x)\n", virtAddr, errCode);
+            sys_exit(0);
+        }
+        
+        return;
+    }
+    
+    // Copies from and to user buffers fail instead
+    if (!isUserInterrupt(stack) && uaccess_fixup(stack))
+        return;
     if (!isUserInterrupt(stack) || !(errCode & PF_USER))
         panic("Kernel attempted to access an illegal address %p (0x%x)", virtAddr, errCode);
     
@@ -63,7 +83,7 @@ static void pageFaultHandler(InterruptStack_t *stack)
     PageTable_t *pml4 = currentProcess()->pml4;
     if (errCode & PF_PRESENT || errCode & PF_WRITABLE)
     {
-        void *frame = pmm_getFrame();
+        void *frame = pmm_getZeroedFrame();
         assert(frame);
         
         vmm_mapPage(pml4, frame, (void *)virtAddr, VMM_USER_ATTRIBUTES);
@@ -176,7 +196,7 @@ void vmm_switchTable(PageTable_t *pml4)
     asm volatile("mov %0, %%cr3" : : "r"(pml4));
 }
 
-void *virt2phys(PageTable_t *pml4, void *virt)
+PageTableEntry_t *vmm_getEntry(PageTable_t *pml4, void *virt)
 {
     uint64_t uvirt = (uint64_t)virt;
     uint64_t pml4Index = (uvirt >> 39) & 0x1FF;
@@ -194,11 +214,16 @@ void *virt2phys(PageTable_t *pml4, void *virt)
         return NULL;
 
     PageTable_t *pt = (PageTable_t *)(pd->entries[pdIndex].attr.address << 12);
-    uint64_t ptIndex = (uvirt >> 12) & 0x1FF;
-    if (!pt->entries[ptIndex].present)
+    return &pt->entries[(uvirt >> 12) & 0x1FF];
+}
+
+void *virt2phys(PageTable_t *pml4, void *virt)
+{
+    PageTableEntry_t *entry = vmm_getEntry(pml4, virt);
+    if (!entry || !entry->present)
         return NULL;
     
-    return (void *)(pt->entries[ptIndex].attr.address << 12);
+    return (void *)(entry->attr.address << 12);
 }
 
 void vmm_mapPage(PageTable_t *pml4, void *phys, void *virt, const uint64_t attr)
@@ -240,7 +265,7 @@ void vmm_identityMapPage(PageTable_t *pml4, void *phys, const uint64_t attr)
     vmm_mapPage(pml4, phys, phys, attr);
 }
 
-void *vmm_unmapPage(PageTable_t *pml4, void *virt)
+void *vmm_detachPage(PageTable_t *pml4, void *virt)
 {
     uint64_t uvirt = (uint64_t)virt;
     uint64_t pml4Index = (uvirt >> 39) & 0x1FF;
@@ -263,8 +288,16 @@ void *vmm_unmapPage(PageTable_t *pml4, void *virt)
         return NULL;
     
     pt->entries[ptIndex].present = 0;
-    void *phys = (void *)(pt->entries[ptIndex].attr.address << 12);
-    pmm_releaseFrame(phys);
+    FLUSH_TLB(uvirt);
+    
+    return (void *)(pt->entries[ptIndex].attr.address << 12);
+}
+
+void *vmm_unmapPage(PageTable_t *pml4, void *virt)
+{
+    void *phys = vmm_detachPage(pml4, virt);
+    if (phys)
+        pmm_releaseFrame(phys);
     
     return phys;
 }
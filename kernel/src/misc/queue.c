@@ -14,11 +14,13 @@ Queue_t *queue_create()
     return q;
 }
 
-void queue_enqueue(Queue_t *q, void *data)
+bool queue_enqueue(Queue_t *q, void *data)
 {
+    QueueNode_t *tmp = (QueueNode_t *)kmalloc(sizeof(QueueNode_t));
+    if (!tmp)
+        return false;
+    
     lock_acquire(&q->lock);
-
-    QueueNode_t *tmp = (QueueNode_t *)kmalloc(sizeof(QueueNode_t *));
     tmp->data = data;
     tmp->next = NULL;
 
@@ -32,6 +34,7 @@ void queue_enqueue(Queue_t *q, void *data)
     
     q->count++;
     lock_release(&q->lock);
+    return true;
 }
 
 void *queue_deqeueue(Queue_t *q)
@@ -67,6 +70,8 @@ void queue_remove(Queue_t *q, void *data)
                 q->front = tmp->next;
             else
                 prev->next = tmp->next;
+            if (q->rear == tmp)
+                q->rear = prev;
             
             q->count--;
             kfree(tmp);
@@ -78,4 +83,6 @@ void queue_remove(Queue_t *q, void *data)
         prev = tmp;
         tmp = tmp->next;
     }
+
+    lock_release(&q->lock);
 }
\ No newline at end of file
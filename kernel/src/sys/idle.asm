@@ -1,7 +1,14 @@
 bits 64
 
+extern pmm_zeroFreeFrame
+
 global x64_idle
 x64_idle:
 .loop:
+    ; fill the zeroed pool before halting
+    call pmm_zeroFreeFrame
+    test al, al
+    jnz .loop
+
     hlt
     jmp .loop
\ No newline at end of file
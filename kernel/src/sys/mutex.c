@@ -0,0 +1,51 @@
+#include <sys/mutex.h>
+#include <sys/scheduler.h>
+#include <io/io.h>
+#include <assert.h>
+
+void mutex_acquire(Mutex_t *mutex)
+{
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&mutex->lock);
+    while (mutex->locked)
+    {
+        // Contention only happens between processes, which all have a stack to sleep on
+        Process_t *current = currentProcess();
+        assert(current && current->kernelStack);
+        
+        current->waitNext = NULL;
+        if (mutex->waitTail)
+            mutex->waitTail->waitNext = current;
+        else
+            mutex->waitHead = current;
+        
+        mutex->waitTail = current;
+        lock_release(&mutex->lock);
+        scheduler_sleep();
+        lock_acquire(&mutex->lock);
+    }
+    
+    mutex->locked = true;
+    lock_release(&mutex->lock);
+    __RESTORE_INTERRUPTS(flags);
+}
+
+void mutex_release(Mutex_t *mutex)
+{
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&mutex->lock);
+    mutex->locked = false;
+    
+    Process_t *waiter = mutex->waitHead;
+    if (waiter)
+    {
+        if (!(mutex->waitHead = waiter->waitNext))
+            mutex->waitTail = NULL;
+        
+        waiter->waitNext = NULL;
+        scheduler_add(waiter);
+    }
+    
+    lock_release(&mutex->lock);
+    __RESTORE_INTERRUPTS(flags);
+}
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include <arch/gdt.h>
 #include <fs/std.h>
 #include <mem/heap.h>
+#include <mem/pmm.h>
+#include <mem/slab.h>
 #include <misc/tree.h>
 #include <assert.h>
 #include <io/io.h>
@@ -13,8 +15,11 @@
 
 #define USER_RFLAGS         0x202
 #define INIT_PROCESS_NAME   "init"
+#define IDLE_PROCESS_NAME   "idle"
+#define KERNEL_STACK_PAGES  (KERNEL_STACK_SIZE / PAGE_SIZE)
 
 static Tree_t *g_processTree = NULL;
+static KmemCache_t *g_processCache = NULL;
 
 static int getNextID()
 {
@@ -36,11 +41,20 @@ static bool createStandardFiles(Process_t *process)
 
 static Process_t *createProcess(const char *name, PageTable_t *addressSpace, void *entry, const ProcessPriority_t priority, void *stackButtom, uint64_t stackSize, const uint64_t cs, const uint64_t ds)
 {
-    Process_t *process = (Process_t *)kmalloc(sizeof(Process_t));
+    Process_t *process = (Process_t *)kmem_cache_alloc(g_processCache);
     if (!process)
         return NULL;
     
     process->pml4 = addressSpace;
+    process->treeNode = NULL;
+    process->kernelStack = NULL;
+    process->waitNext = NULL;
+    process->mappings = NULL;
+    process->mmapNext = MMAP_START;
+    process->runNext = process->runPrev = NULL;
+    process->runQueue = NULL;
+    process->running = false;
+    process->core = -1;
     strcpy(process->name, name);
     strcpy(process->cwd, FS_PATH_SEPERATOR_STR);
     
@@ -81,10 +95,13 @@ Process_t *process_init()
 
     // Create the process tree
     assert(g_processTree = tree_create());
+    assert(g_processCache = kmem_cache_create("process", sizeof(Process_t)));
     
     // Create the idle process
     
-    Process_t *idle = createProcess(INIT_PROCESS_NAME, _KernelPML4, x64_idle, PriorityIdle, 0, 0, GDT_KERNEL_CS, GDT_KERNEL_DS);
+    void *idleStack = pmm_getFrames(KERNEL_STACK_PAGES);
+    assert(idleStack);
+    Process_t *idle = createProcess(INIT_PROCESS_NAME, _KernelPML4, x64_idle, PriorityIdle, idleStack, KERNEL_STACK_SIZE, GDT_KERNEL_CS, GDT_KERNEL_DS);
     assert(idle);
 
     // Insert idle process as root process
@@ -95,6 +112,22 @@ Process_t *process_init()
     return idle;
 }
 
+Process_t *process_createIdle()
+{
+    extern void x64_idle();
+    
+    // Idle processes of other cores aren't part of the process tree
+    void *idleStack = pmm_getFrames(KERNEL_STACK_PAGES);
+    if (!idleStack)
+        return NULL;
+    
+    Process_t *idle = createProcess(IDLE_PROCESS_NAME, _KernelPML4, x64_idle, PriorityIdle, idleStack, KERNEL_STACK_SIZE, GDT_KERNEL_CS, GDT_KERNEL_DS);
+    if (!idle)
+        pmm_releaseFrames(idleStack, KERNEL_STACK_PAGES);
+    
+    return idle;
+}
+
 Process_t *process_create(Process_t *parent, const char *name, void *entry, const ProcessPriority_t priority)
 {
     // Create a page table for the process and map the stack
@@ -120,6 +153,13 @@ Process_t *process_create(Process_t *parent, const char *name, void *entry, cons
     }
     tree_insert(g_processTree, g_processTree->root, process->treeNode);
     
+    // Stack for system calls, the process may sleep inside them
+    if (!(process->kernelStack = pmm_getFrames(KERNEL_STACK_PAGES)))
+    {
+        process_delete(process);
+        return NULL;
+    }
+    
     // Notify the scheduler about the process
     scheduler_add(process);    
     return process;
@@ -139,6 +179,7 @@ void process_delete(Process_t *process)
     // Delete the page table and switch to kernel one
     if (process->pml4)
     {
+        mmap_releaseAll(process);
         assert(parentProcess);
         vmm_switchTable(_KernelPML4);
         vmm_destroyAddressSpace(parentProcess->pml4, process->pml4);    
@@ -155,7 +196,17 @@ void process_delete(Process_t *process)
         kfree(process->fdt);
     }
     
-    kfree(process);
+    // An exiting process still runs on its kernel stack, free it on the next delete on the same core
+    if (process->kernelStack)
+    {
+        CoreContext_t *core = currentCPU();
+        if (core->deadStack)
+            pmm_releaseFrames(core->deadStack, KERNEL_STACK_PAGES);
+        
+        core->deadStack = process->kernelStack;
+    }
+    
+    kmem_cache_free(g_processCache, process);
 }
 
 int process_add_file(Process_t *process, VfsNode_t *node)
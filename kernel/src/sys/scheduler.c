@@ -1,7 +1,8 @@
 #include <sys/scheduler.h>
 #include <arch/apic/apic.h>
+#include <arch/gdt.h>
 #include <mem/heap.h>
-#include <misc/queue.h>
+#include <arch/lock.h>
 #include <io/io.h>
 #include <assert.h>
 #include <panic.h>
@@ -13,54 +14,214 @@
 })
 
 extern void x64_context_switch(Context_t *ctx);
+extern uint64_t x64_save_context(Context_t *ctx);
+extern void x64_switch_stack(uint64_t stack, void (*function)(Process_t *), Process_t *argument);
 
-static Queue_t **g_processQueues = NULL;
+#define CORE_INDEX(core)    ((int)((core) - _Cores))
 
-static Process_t *getNextProcess()
+static void enqueue(RunQueue_t *rq, Process_t *process)
 {
-    // Search for the last index because the priorities are opposite in order
-    for (int i = PROCESS_PRIORITIES_COUNT - 1; i >= 0; i--)
+    int priority = process->priority;
+    process->runNext = NULL;
+    process->runPrev = rq->tails[priority];
+    if (rq->tails[priority])
+        rq->tails[priority]->runNext = process;
+    else
+        rq->heads[priority] = process;
+    
+    rq->tails[priority] = process;
+    rq->bitmap |= 1 << priority;
+    rq->count++;
+    process->runQueue = rq;
+}
+
+static void unlink(RunQueue_t *rq, Process_t *process)
+{
+    int priority = process->priority;
+    if (process->runPrev)
+        process->runPrev->runNext = process->runNext;
+    else
+        rq->heads[priority] = process->runNext;
+    if (process->runNext)
+        process->runNext->runPrev = process->runPrev;
+    else
+        rq->tails[priority] = process->runPrev;
+    
+    if (!rq->heads[priority])
+        rq->bitmap &= ~(1 << priority);
+    
+    rq->count--;
+    process->runNext = process->runPrev = NULL;
+    process->runQueue = NULL;
+}
+
+static Process_t *dequeue(RunQueue_t *rq)
+{
+    if (!rq->bitmap)
+        return NULL;
+    
+    // The highest set bit is the most important priority with queued processes
+    Process_t *process = rq->heads[31 - __builtin_clz(rq->bitmap)];
+    unlink(rq, process);
+    return process;
+}
+
+static Process_t *steal(CoreContext_t *core)
+{
+    // Counts are only a hint, the queue may be empty once it's locked
+    CoreContext_t *busiest = NULL;
+    for (uint32_t i = 0; i < _CoreCount; i++)
     {
-        Queue_t *q = g_processQueues[i];
-        if (q->count > 0)
-            return queue_deqeueue(q);
+        CoreContext_t *other = &_Cores[i];
+        if (other != core && other->runQueue.count && (!busiest || other->runQueue.count > busiest->runQueue.count))
+            busiest = other;
     }
+    
+    if (!busiest)
+        return NULL;
+    
+    lock_acquire(&busiest->runQueue.lock);
+    Process_t *process = dequeue(&busiest->runQueue);
+    lock_release(&busiest->runQueue.lock);
+    return process;
+}
+
+static Process_t *getNextProcess(CoreContext_t *core)
+{
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&core->runQueue.lock);
+    Process_t *next = dequeue(&core->runQueue);
+    lock_release(&core->runQueue.lock);
+    
+    // Only one run queue is locked at a time, so cores stealing from each other can't deadlock
+    if (!next && !(next = steal(core)))
+        next = core->idle;
+    
+    __RESTORE_INTERRUPTS(flags);
+    return next;
+}
+
+static CoreContext_t *leastLoadedCore()
+{
+    CoreContext_t *core = &_Cores[0];
+    for (uint32_t i = 1; i < _CoreCount; i++)
+    {
+        if (_Cores[i].runQueue.count < core->runQueue.count)
+            core = &_Cores[i];
+    }
+    
+    return core;
+}
+
+static __NO_RETURN__ void switchProcess(Process_t *next)
+{
+    CoreContext_t *core = currentCPU();
+    Process_t *prev = core->currentProcess;
+    if (prev != next)
+    {
+        // The core no longer uses the stack of the previous process, other cores may resume it
+        if (prev)
+            prev->running = false;
         
-    panic("No processes in scheduler");
+        // Wait for the core the next process was woken on to switch away from it
+        while (next->running)
+            __PAUSE();
+        
+        next->running = true;
+        next->core = CORE_INDEX(core);
+    }
+    
+    // Every process enters the kernel on its own stack, so it can sleep inside it
+    core->currentProcess = next;
+    if (next->kernelStack)
+    {
+        tss_setKernelStack(next->kernelStack, KERNEL_STACK_SIZE);
+        core->syscallStack = (uint64_t)next->kernelStack + KERNEL_STACK_SIZE;
+    }
+    
+    SWITCH_PROCESS(next);
+    __builtin_unreachable();
 }
 
 void scheduler_init()
 {
-    // Create the process queues
-    assert(g_processQueues = (Queue_t **)kmalloc(sizeof(Queue_t *) * PROCESS_PRIORITIES_COUNT));
-    for (uint16_t i = 0; i < PROCESS_PRIORITIES_COUNT; i++)
-       assert(g_processQueues[i] = queue_create());
+    for (uint32_t i = 0; i < _CoreCount; i++)
+    {
+        RunQueue_t *rq = &_Cores[i].runQueue;
+        for (uint16_t j = 0; j < PROCESS_PRIORITIES_COUNT; j++)
+            rq->heads[j] = rq->tails[j] = NULL;
+        
+        rq->bitmap = 0;
+        rq->count = 0;
+        rq->lock = 0;
+        
+        // Every core runs its own idle process when there is nothing else to run
+        if (_Cores[i].id == _BspID)
+            _Cores[i].idle = currentProcess();
+        else
+            assert(_Cores[i].idle = process_createIdle());
+    }
     
-    scheduler_add(currentProcess());
     LOG("Scheduler initialized\n");
 }
 
 void scheduler_add(Process_t *process)
 {
     assert(process->priority >= 0 && process->priority < PROCESS_PRIORITIES_COUNT);
-    queue_enqueue(g_processQueues[process->priority], process);
+    
+    // Wake processes on the core they last ran on, where their data may still be cached
+    CoreContext_t *core = process->core >= 0 ? &_Cores[process->core] : leastLoadedCore();
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&core->runQueue.lock);
+    
+    // The links are embedded in the process, a queued process stays where it is
+    if (!process->runQueue)
+        enqueue(&core->runQueue, process);
+    
+    lock_release(&core->runQueue.lock);
+    __RESTORE_INTERRUPTS(flags);
 }
 
 void scheduler_remove(Process_t *process)
 {
     assert(process->priority >= 0 && process->priority < PROCESS_PRIORITIES_COUNT);
-    queue_remove(g_processQueues[process->priority], process);
+    RunQueue_t *rq = process->runQueue;
+    if (!rq)
+        return;
+    
+    // Another core may have taken the process off the queue before it was locked
+    uint64_t flags = __SAVE_INTERRUPTS();
+    lock_acquire(&rq->lock);
+    if (process->runQueue == rq)
+        unlink(rq, process);
+    
+    lock_release(&rq->lock);
+    __RESTORE_INTERRUPTS(flags);
+}
+
+void scheduler_sleep()
+{
+    __CLI();
+    
+    // Returns a second time when the process is switched back to
+    if (x64_save_context(&currentProcess()->ctx))
+    {
+        __CLI();
+        return;
+    }
+    
+    yield(NULL);
 }
 
 void yield(Process_t *process)
 {
+    __CLI();
     CoreContext_t *core = currentCPU();
-    if (process)
-        core->currentProcess = process;
-    else
-        core->currentProcess = getNextProcess();
+    if (!process)
+        process = getNextProcess(core);
     
-    SWITCH_PROCESS(core->currentProcess);
+    // A process woken on another core may be resumed there once the core leaves its stack
+    x64_switch_stack(core->stack, switchProcess, process);
 }
 
 Process_t *dispatch(InterruptStack_t *stack)
@@ -87,11 +248,17 @@ Process_t *dispatch(InterruptStack_t *stack)
     current->ctx.r14 = stack->r14;
     current->ctx.r15 = stack->r15;   
     
-    queue_enqueue(g_processQueues[current->priority], current);
-    return getNextProcess();
+    CoreContext_t *core = currentCPU();
+    if (current != core->idle)
+        scheduler_add(current);
+    
+    return getNextProcess(core);
 }
 
 Process_t *currentProcess()
 {
-    return currentCPU()->currentProcess;
+    // A single load through the GS base of the core
+    Process_t *process;
+    asm volatile("mov %%gs:%c1, %0" : "=r"(process) : "i"(offsetof(CoreContext_t, currentProcess)));
+    return process;
 }
\ No newline at end of file
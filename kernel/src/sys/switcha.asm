@@ -1,5 +1,8 @@
 bits 64
 
+%define KERNEL_CS   0x8
+%define KERNEL_DS   0x10
+
 global x64_context_switch
 x64_context_switch:  ; rdi - Context_t*
     cli
@@ -8,8 +11,7 @@ x64_context_switch:  ; rdi - Context_t*
     mov ax, [rdi + 0x20]        ; ds
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
+    mov fs, ax                  ; gs keeps the base of the core
     
     push rax                    ; ss
     push qword [rdi + 0x10]     ; rsp
@@ -40,5 +42,39 @@ x64_context_switch:  ; rdi - Context_t*
     mov r14, [rdi + 0x90]
     mov r15, [rdi + 0x98]
     mov rdi, [rdi + 0x48]
-        
-    iretq
\ No newline at end of file
+    
+    ; user space runs with its own gs base
+    test qword [rsp + 8], 3
+    jz .iret
+    swapgs
+.iret:
+    iretq
+
+global x64_save_context
+x64_save_context:   ; rdi - Context_t*
+    mov rax, [rsp]
+    mov [rdi], rax              ; rip - return address
+    mov qword [rdi + 0x8], KERNEL_CS
+    lea rax, [rsp + 8]
+    mov [rdi + 0x10], rax       ; rsp - after returning
+    pushfq
+    pop qword [rdi + 0x18]      ; rflags
+    mov qword [rdi + 0x20], KERNEL_DS
+    
+    ; returns 1 when switched back to
+    mov qword [rdi + 0x28], 1   ; rax
+    mov [rdi + 0x30], rbx
+    mov [rdi + 0x58], rbp
+    mov [rdi + 0x80], r12
+    mov [rdi + 0x88], r13
+    mov [rdi + 0x90], r14
+    mov [rdi + 0x98], r15
+    
+    xor rax, rax
+    ret
+
+global x64_switch_stack
+x64_switch_stack:   ; rdi - stack top, rsi - function, rdx - argument
+    mov rsp, rdi
+    mov rdi, rdx
+    call rsi            ; doesn't return
\ No newline at end of file
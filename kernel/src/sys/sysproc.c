@@ -1,4 +1,5 @@
 #include <sys/scheduler.h>
+#include <arch/apic/apic.h>
 #include <io/io.h>
 #include <assert.h>
 #include <panic.h>
@@ -16,9 +17,9 @@ void sys_exit(int status)
     // Delete the process
     LOG_PROC("sys_exit with status %d\n", status);
     process_delete(current);
+    currentCPU()->currentProcess = NULL;
     
     // Execute another process
-    __STI();
     yield(NULL);
     
     panic("Unreachable");
@@ -0,0 +1,55 @@
+bits 64
+
+%define KERNEL_DS           0x10
+%define USER_DS             0x23
+
+; offsets in CoreContext_t
+%define CORE_SYSCALL_STACK  0x8
+%define CORE_USER_STACK     0x10
+
+extern syscall_dispatch
+
+global x64_syscall_entry
+x64_syscall_entry:  ; rcx - user rip, r11 - user rflags, interrupts are masked
+    swapgs
+    mov [gs:CORE_USER_STACK], rsp
+    mov rsp, [gs:CORE_SYSCALL_STACK]
+    
+    ; the process may continue on another core, keep its state on its own stack
+    push qword [gs:CORE_USER_STACK]
+    push r11
+    push rcx
+    push rdi
+    push rsi
+    push rdx
+    push r10
+    push r8
+    push r9
+    
+    mov cx, KERNEL_DS
+    mov ds, cx
+    mov es, cx
+    
+    ; arguments in the order of the C calling convention, the number is passed on the stack
+    mov rcx, r10
+    push rax
+    call syscall_dispatch
+    add rsp, 8
+    
+    cli                     ; the handler may have slept with interrupts enabled
+    mov cx, USER_DS
+    mov ds, cx
+    mov es, cx
+    
+    pop r9
+    pop r8
+    pop r10
+    pop rdx
+    pop rsi
+    pop rdi
+    pop rcx
+    pop r11
+    mov rsp, [rsp]
+    
+    swapgs
+    o64 sysret
\ No newline at end of file
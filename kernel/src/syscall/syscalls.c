@@ -1,11 +1,20 @@
 #include <syscall/syscalls.h>
 #include <sys/scheduler.h>
 #include <arch/isr.h>
+#include <arch/cpu.h>
+#include <arch/gdt.h>
 #include <io/io.h>
 #include <assert.h>
 #include <logger.h>
 #include <errno.h>
 
+#define IA32_EFER_MSR       0xC0000080
+#define IA32_STAR_MSR       0xC0000081
+#define IA32_LSTAR_MSR      0xC0000082
+#define IA32_FMASK_MSR      0xC0000084
+#define EFER_SCE            (1 << 0)
+#define SYSCALL_MASK        0x600       /* Interrupts stay disabled and string operations go forwards. */
+
 extern ssize_t sys_read(uint32_t fd, void *buf, size_t count);
 extern ssize_t sys_write(uint32_t fd, const void *buf, size_t count);
 extern int sys_open(const char *path, int flags, int mode);
@@ -18,6 +27,10 @@ extern struct dirent *sys_readdir(DIR *dirp);
 extern void sys_closedir(DIR *dirp);
 extern int sys_chdir(const char *path);
 extern char *sys_getcwd(char *buf, size_t size);
+extern ssize_t sys_getdents(uint32_t fd, struct dirent *buf, size_t count);
+extern int sys_fsync(uint32_t fd);
+extern void *sys_mmap(void *addr, size_t length, int prot, int flags, uint32_t fd, long offset);
+extern int sys_munmap(void *addr, size_t length);
 
 typedef uint64_t (*syscall_func_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
 static syscall_func_t g_syscalls[] = 
@@ -34,19 +47,42 @@ static syscall_func_t g_syscalls[] =
     [SYSCALL_READDIR]   = (syscall_func_t)(uint64_t)sys_readdir,
     [SYSCALL_CLOSEDIR]  = (syscall_func_t)(uint64_t)sys_closedir,
     [SYSCALL_CHDIR]     = (syscall_func_t)(uint64_t)sys_chdir,
-    [SYSCALL_GETCWD]    = (syscall_func_t)(uint64_t)sys_getcwd
+    [SYSCALL_GETCWD]    = (syscall_func_t)(uint64_t)sys_getcwd,
+    [SYSCALL_GETDENTS]  = (syscall_func_t)(uint64_t)sys_getdents,
+    [SYSCALL_FSYNC]     = (syscall_func_t)(uint64_t)sys_fsync,
+    [SYSCALL_MMAP]      = (syscall_func_t)(uint64_t)sys_mmap,
+    [SYSCALL_MUNMAP]    = (syscall_func_t)(uint64_t)sys_munmap
 };
 
+uint64_t syscall_dispatch(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5, uint64_t arg6, uint64_t num)
+{
+    if (num >= sizeof(g_syscalls) / sizeof(g_syscalls[0]) || !g_syscalls[num])
+        return -ENOSYS;
+    
+    return g_syscalls[num](arg1, arg2, arg3, arg4, arg5, arg6);
+}
+
 static void syscallHandler(InterruptStack_t *stack)
 {
-    uint64_t num = stack->rax;
-    if (!g_syscalls[num])
-        stack->rax = ENOSYS;
-    else
-        stack->rax = g_syscalls[num](stack->rdi, stack->rsi, stack->rdx, stack->r10, stack->r8, stack->r9);
+    stack->rax = syscall_dispatch(stack->rdi, stack->rsi, stack->rdx, stack->r10, stack->r8, stack->r9, stack->rax);
+}
+
+void syscalls_initCore()
+{
+    extern void x64_syscall_entry();
+    
+    uint32_t lo, hi;
+    __rdmsr(IA32_EFER_MSR, &lo, &hi);
+    __wrmsr(IA32_EFER_MSR, lo | EFER_SCE, hi);
+    
+    // SYSRET loads the user data segment from the base + 8 and the user code segment from the base + 16
+    __wrmsr(IA32_STAR_MSR, 0, GDT_KERNEL_CS | ((GDT_USER_DS - 8) << 16));
+    __wrmsr(IA32_LSTAR_MSR, (uint32_t)(uint64_t)x64_syscall_entry, (uint32_t)((uint64_t)x64_syscall_entry >> 32));
+    __wrmsr(IA32_FMASK_MSR, SYSCALL_MASK, 0);
 }
 
 void syscalls_init()
 {
     assert(isr_registerHandler(SYSCALL_ISR, syscallHandler));
+    syscalls_initCore();
 }
\ No newline at end of file
@@ -14,4 +14,5 @@
 #define	O_NOFOLLOW	0x0100		/* don't follow symlinks */
 #define	O_CREAT		0x0200		/* create if nonexistent */
 #define	O_TRUNC		0x0400		/* truncate to zero length */
-#define	O_EXCL		0x0800		/* error if already exists */
\ No newline at end of file
+#define	O_EXCL		0x0800		/* error if already exists */
+#define	O_DIRECT	0x1000		/* read whole blocks straight from the disk */
\ No newline at end of file
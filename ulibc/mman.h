@@ -0,0 +1,22 @@
+#pragma once
+
+#include <syscall.h>
+
+#define PROT_NONE   0x0
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+#define MAP_SHARED  0x1
+#define MAP_PRIVATE 0x2
+
+inline void *mmap(void *addr, size_t length, int prot, int flags, uint32_t fd, long offset)
+{
+    uint64_t ret = SYSCALL_6(SYSCALL_MMAP, (uint64_t)addr, length, prot, flags, fd, offset);
+    return (void *)ret;
+}
+
+inline int munmap(void *addr, size_t length)
+{
+    return SYSCALL_2(SYSCALL_MUNMAP, (uint64_t)addr, length);
+}
\ No newline at end of file
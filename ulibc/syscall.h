@@ -18,11 +18,15 @@ typedef long ssize_t;
 #define SYSCALL_CLOSEDIR    10
 #define SYSCALL_CHDIR       11
 #define SYSCALL_GETCWD      12
+#define SYSCALL_GETDENTS    13
+#define SYSCALL_FSYNC       14
+#define SYSCALL_MMAP        15
+#define SYSCALL_MUNMAP      16
 
 #define SYSCALL_0(n) ({             \
     uint64_t __result;              \
     asm volatile(                   \
-        "int $0x80"                 \
+        "syscall"                   \
         : "=a" (__result)           \
         : "0" (n)                   \
         : "rcx", "r11", "memory"    \
@@ -33,7 +37,7 @@ typedef long ssize_t;
 #define SYSCALL_1(n, arg1) ({       \
     uint64_t __result;              \
     asm volatile(                   \
-        "int $0x80"                 \
+        "syscall"                   \
         : "=a" (__result)           \
         : "0" (n), "D" (arg1)       \
         : "rcx", "r11", "memory"    \
@@ -44,7 +48,7 @@ typedef long ssize_t;
 #define SYSCALL_2(n, arg1, arg2) ({         \
     uint64_t __result;                      \
     asm volatile(                           \
-        "int $0x80"                         \
+        "syscall"                           \
         : "=a" (__result)                   \
         : "0" (n), "D" (arg1), "S" (arg2)   \
         : "rcx", "r11", "memory"            \
@@ -55,7 +59,7 @@ typedef long ssize_t;
 #define SYSCALL_3(n, arg1, arg2, arg3) ({               \
     uint64_t __result;                                  \
     asm volatile(                                       \
-        "int $0x80"                                     \
+        "syscall"                                       \
         : "=a" (__result)                               \
         : "0" (n), "D" (arg1), "S" (arg2), "d" (arg3)   \
         : "rcx", "r11", "memory"                        \
@@ -65,11 +69,26 @@ typedef long ssize_t;
 
 #define SYSCALL_4(n, arg1, arg2, arg3, arg4) ({                     \
     uint64_t __result;                                              \
+    register uint64_t __r10 asm("r10") = (uint64_t)(arg4);          \
     asm volatile(                                                   \
-        "int $0x80"                                                 \
+        "syscall"                                                   \
         : "=a" (__result)                                           \
-        : "0" (n), "D" (arg1), "S" (arg2), "d" (arg3), "r"(arg4)    \
+        : "0" (n), "D" (arg1), "S" (arg2), "d" (arg3), "r" (__r10)  \
         : "rcx", "r11", "memory"                                    \
     );                                                              \
     __result;                                                       \
 })
+
+#define SYSCALL_6(n, arg1, arg2, arg3, arg4, arg5, arg6) ({                         \
+    uint64_t __result;                                                              \
+    register uint64_t __r10 asm("r10") = (uint64_t)(arg4);                          \
+    register uint64_t __r8 asm("r8") = (uint64_t)(arg5);                            \
+    register uint64_t __r9 asm("r9") = (uint64_t)(arg6);                            \
+    asm volatile(                                                                   \
+        "syscall"                                                                   \
+        : "=a" (__result)                                                           \
+        : "0" (n), "D" (arg1), "S" (arg2), "d" (arg3), "r" (__r10), "r" (__r8), "r" (__r9) \
+        : "rcx", "r11", "memory"                                                    \
+    );                                                                              \
+    __result;                                                                       \
+})
@@ -3,6 +3,7 @@
 #include <syscall.h>
 
 #define MAX_PATH    256
+#define DIR_BUFFER_ENTRIES  8
 
 typedef struct dirent
 {
@@ -14,6 +15,8 @@ typedef struct DIR
 {
     uint32_t d_fd;
     size_t d_currentEntry;
+    size_t d_bufferedEntries;
+    struct dirent d_entries[DIR_BUFFER_ENTRIES];
 } DIR;
 
 inline ssize_t read(uint32_t fd, void *buf, size_t count)
@@ -62,10 +65,30 @@ inline DIR *opendir(const char *name)
     return (DIR *)ret;
 }
 
+inline int fsync(uint32_t fd)
+{
+    return SYSCALL_1(SYSCALL_FSYNC, fd);
+}
+
+inline ssize_t getdents(uint32_t fd, struct dirent *dirp, size_t count)
+{
+    return SYSCALL_3(SYSCALL_GETDENTS, fd, (uint64_t)dirp, count);
+}
+
 inline struct dirent *readdir(DIR *dirp)
 {
-    uint64_t ret = SYSCALL_1(SYSCALL_READDIR, (uint64_t)dirp);
-    return (struct dirent *)ret;
+    // Refill the buffered entries in a single call
+    if (dirp->d_currentEntry >= dirp->d_bufferedEntries)
+    {
+        ssize_t ret = getdents(dirp->d_fd, dirp->d_entries, sizeof(dirp->d_entries));
+        if (ret <= 0)
+            return NULL;
+        
+        dirp->d_bufferedEntries = ret / sizeof(struct dirent);
+        dirp->d_currentEntry = 0;
+    }
+    
+    return &dirp->d_entries[dirp->d_currentEntry++];
 }
 
 inline void closedir(DIR *dirp)